@@ -84,7 +84,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -209,21 +209,9 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
 
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multiple (d, sec_no, &buffer, 1);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +221,79 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
+	ASSERT (buffer != NULL);
+
+	disk_write_multiple (d, sec_no, &buffer, 1);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D with a
+   single command, sector SEC_NO + i into SECTORS[i], each of
+   which must have room for DISK_SECTOR_SIZE bytes.  CNT must be
+   between 1 and DISK_MULTIPLE_MAX.
+   Every sector still crosses the data register one at a time,
+   but the command setup and seek are paid only once, which is
+   most of the cost of a single-sector transfer. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no,
+		void *const sectors[], size_t cnt) {
 	struct channel *c;
+	size_t i;
 
 	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MULTIPLE_MAX);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+	for (i = 0; i < cnt; i++) {
+		ASSERT (sectors[i] != NULL);
+
+		/* The disk interrupts once per sector, when its data is
+		   ready to be read. */
+		sema_down (&c->completion_wait);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk read failed, sector=%"PRDSNu,
+					d->name, sec_no + (disk_sector_t) i);
+		input_sector (c, sectors[i]);
+	}
+	d->read_cnt += cnt;
+	lock_release (&c->lock);
+}
+
+/* Writes the CNT sectors starting at SEC_NO on disk D with a
+   single command, sector SEC_NO + i from SECTORS[i], each of
+   which must contain DISK_SECTOR_SIZE bytes.  CNT must be
+   between 1 and DISK_MULTIPLE_MAX.  Returns after the disk has
+   acknowledged receiving all of the data. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no,
+		const void *const sectors[], size_t cnt) {
+	struct channel *c;
+	size_t i;
+
+	ASSERT (d != NULL);
+	ASSERT (cnt > 0 && cnt <= DISK_MULTIPLE_MAX);
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, cnt);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	for (i = 0; i < cnt; i++) {
+		ASSERT (sectors[i] != NULL);
+
+		/* The disk asks for each sector with DRQ and interrupts
+		   once it has taken it. */
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk write failed, sector=%"PRDSNu,
+					d->name, sec_no + (disk_sector_t) i);
+		output_sector (c, sectors[i]);
+		sema_down (&c->completion_wait);
+	}
+	d->write_cnt += cnt;
 	lock_release (&c->lock);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,17 +446,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.)  A count of 256 is written as
+   0, as ATA specifies. */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
 	ASSERT (sec_no < d->capacity);
+	ASSERT (cnt <= d->capacity - sec_no);
 	ASSERT (sec_no < (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt % 256);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
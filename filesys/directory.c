@@ -32,6 +32,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_set_uncached (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -6,6 +6,10 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -34,6 +38,10 @@ struct inode {
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+#ifdef VM
+	struct hash cache;                  /* Page cache, by offset. */
+	bool uncached;                      /* Read around the page cache? */
+#endif
 };
 
 /* Returns the disk sector that contains byte offset POS within
@@ -57,6 +65,9 @@ static struct list open_inodes;
 void
 inode_init (void) {
 	list_init (&open_inodes);
+#ifdef VM
+	page_cache_init ();
+#endif
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -118,6 +129,13 @@ inode_open (disk_sector_t sector) {
 	inode = malloc (sizeof *inode);
 	if (inode == NULL)
 		return NULL;
+#ifdef VM
+	if (!page_cache_create (&inode->cache)) {
+		free (inode);
+		return NULL;
+	}
+	inode->uncached = false;
+#endif
 
 	/* Initialize. */
 	list_push_front (&open_inodes, &inode->elem);
@@ -156,6 +174,9 @@ inode_close (struct inode *inode) {
 	if (--inode->open_cnt == 0) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
+#ifdef VM
+		page_cache_destroy (&inode->cache);
+#endif
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
@@ -176,11 +197,11 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
- * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+/* Reads SIZE bytes from INODE's sectors on disk into BUFFER,
+ * starting at OFFSET, as inode_read_at() does, but without the page
+ * cache. */
+static off_t
+read_disk (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
@@ -225,13 +246,75 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+#ifdef VM
+	if (!inode->uncached)
+		return page_cache_read (inode, buffer, size, offset);
+#endif
+	return read_disk (inode, buffer, size, offset);
+}
+
+/* Reads PAGE_CNT pages of INODE, starting at OFFSET, which must be
+ * sector-aligned, into the pages at PAGES[].  Runs of consecutive
+ * sectors are read with one disk command each, however the pages
+ * lie in memory.  Bytes past the end of INODE read as zeros.
+ * Returns the number of bytes actually read from INODE. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_read_pages (struct inode *inode, void *const pages[], size_t page_cnt,
+		off_t offset) {
+	const size_t page_sectors = PGSIZE / DISK_SECTOR_SIZE;
+	off_t length = inode_length (inode);
+	off_t bytes = 0;
+	size_t sector_cnt, i;
+	void **sectors = NULL;
+
+	ASSERT (offset % DISK_SECTOR_SIZE == 0);
+
+	if (offset < length)
+		bytes = length - offset < (off_t) (page_cnt * PGSIZE)
+			? length - offset : (off_t) (page_cnt * PGSIZE);
+	sector_cnt = DIV_ROUND_UP (bytes, DISK_SECTOR_SIZE);
+	if (sector_cnt > 0) {
+		sectors = malloc (sizeof *sectors * DISK_MULTIPLE_MAX);
+		if (sectors == NULL)
+			bytes = sector_cnt = 0;
+	}
+
+	for (i = 0; i < sector_cnt; ) {
+		size_t cnt = sector_cnt - i < DISK_MULTIPLE_MAX
+			? sector_cnt - i : DISK_MULTIPLE_MAX;
+		size_t j;
+
+		for (j = 0; j < cnt; j++)
+			sectors[j] = (uint8_t *) pages[(i + j) / page_sectors]
+				+ (i + j) % page_sectors * DISK_SECTOR_SIZE;
+		disk_read_multiple (filesys_disk,
+				byte_to_sector (inode, offset) + i, sectors, cnt);
+		i += cnt;
+	}
+	free (sectors);
+
+	for (i = 0; i < page_cnt; i++) {
+		off_t page_ofs = (off_t) (i * PGSIZE);
+
+		if (bytes < page_ofs + PGSIZE) {
+			off_t ofs = bytes > page_ofs ? bytes - page_ofs : 0;
+
+			memset ((uint8_t *) pages[i] + ofs, 0, PGSIZE - ofs);
+		}
+	}
+	return bytes;
+}
+
+/* Writes SIZE bytes from BUFFER to INODE's sectors on disk, starting
+ * at OFFSET, as inode_write_at() does, but leaves the page cache
+ * alone. */
+static off_t
+write_disk (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
@@ -287,6 +370,82 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	return bytes_written;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if end of file is reached or an error occurs.
+ * (Normally a write at end of file would extend the inode, but
+ * growth is not yet implemented.) */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written = write_disk (inode, buffer, size, offset);
+
+#ifdef VM
+	/* Writes go through to disk; the cached copy follows. */
+	page_cache_update (inode, buffer, bytes_written, offset);
+#endif
+	return bytes_written;
+}
+
+/* Writes PAGE, a page of INODE's data from OFFSET, which must be
+ * page-aligned, back to disk, bypassing the page cache.  Only the
+ * part within the file is written.  Returns the number of bytes
+ * written. */
+off_t
+inode_write_page (struct inode *inode, const void *page, off_t offset) {
+	off_t length = inode_length (inode);
+	off_t bytes = length - offset < PGSIZE ? length - offset : PGSIZE;
+	size_t full = bytes / DISK_SECTOR_SIZE;
+	const void *sectors[PGSIZE / DISK_SECTOR_SIZE];
+	size_t i;
+
+	ASSERT (offset % PGSIZE == 0);
+
+	if (bytes <= 0 || inode->deny_write_cnt)
+		return 0;
+
+	/* Whole sectors go in one disk command. */
+	for (i = 0; i < full; i++)
+		sectors[i] = (uint8_t *) page + i * DISK_SECTOR_SIZE;
+	if (full > 0)
+		disk_write_multiple (filesys_disk, byte_to_sector (inode, offset),
+				sectors, full);
+
+	/* The last sector is padded with zeros rather than whatever lies
+	 * past the end of the file in PAGE. */
+	if (bytes % DISK_SECTOR_SIZE != 0) {
+		uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
+
+		if (bounce == NULL)
+			return full * DISK_SECTOR_SIZE;
+		memcpy (bounce, (uint8_t *) page + full * DISK_SECTOR_SIZE,
+				bytes % DISK_SECTOR_SIZE);
+		disk_write (filesys_disk,
+				byte_to_sector (inode, offset + full * DISK_SECTOR_SIZE), bounce);
+		free (bounce);
+	}
+	return bytes;
+}
+
+/* Keeps INODE, which holds file system metadata (the free map or a
+ * directory), out of the page cache: its reads go straight to disk.
+ * Metadata is read before the virtual memory system is up, and
+ * should not take frames that user pages compete for. */
+void
+inode_set_uncached (struct inode *inode UNUSED) {
+#ifdef VM
+	inode->uncached = true;
+#endif
+}
+
+#ifdef VM
+/* Returns INODE's page cache. */
+struct hash *
+inode_page_cache (struct inode *inode) {
+	return &inode->cache;
+}
+#endif
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 	void
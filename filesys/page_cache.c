@@ -1,50 +1,268 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
+#include "filesys/page_cache.h"
+#ifdef VM
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
-static bool page_cache_readahead (struct page *page, void *kva);
-static bool page_cache_writeback (struct page *page);
-static void page_cache_destroy (struct page *page);
 
-/* DO NOT MODIFY this struct */
-static const struct page_operations page_cache_op = {
-	.swap_in = page_cache_readahead,
-	.swap_out = page_cache_writeback,
-	.destroy = page_cache_destroy,
-	.type = VM_PAGE_CACHE,
-};
+/* Page cache.
+ *
+ * Each open inode keeps the pages of its data that are in memory in
+ * a hash table of struct cache_page, by offset.  The data of a cached
+ * page is in a frame of the frame table, whose CACHE member points
+ * back to it, so that cached file data competes for memory with
+ * everything else and the clock evicts it like any other frame.
+ *
+ * read() reads through the cache: missing pages are read into new
+ * frames, each run of them with one disk request, and copied out from
+ * there.  write() writes through: the data goes to disk as before, and
+ * also into the cached page, if there is one.  mmap() does not copy at
+ * all.  A mapped page maps the frame of its cache page, writable, so
+ * every mapping of a page, read(), and write() all see one copy of the
+ * data, and a page read with read() is mapped without more I/O.  What
+ * is written through a mapping reaches the disk when the mapping's
+ * dirty page is written back, by munmap(), flushing, or eviction.
+ * File system metadata, the free map and directories, stays out of
+ * the cache and is read straight from disk; see inode_set_uncached().
+ *
+ * A cache page holds a reference for each page that maps it and each
+ * read() or write() using it, plus one for its frame, and is freed
+ * when the last goes.  The pages left when an inode is closed for the
+ * last time are unmapped, and page_cache_destroy() frees their frames.
+ *
+ * A read() holds the file system lock while it waits for a cache page
+ * to be read in or evicted, so cache I/O goes straight to the inode's
+ * sectors without taking it. */
 
-tid_t page_cache_workerd;
+/* Protects the caches and the cache pages' REF_CNT.  May be acquired
+ * while holding the frame table lock. */
+static struct lock cache_lock;
 
-/* The initializer of file vm */
+/* Most pages page_cache_read() reads in with one disk request. */
+#define READ_BATCH 16
+
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct cache_page *cp = hash_entry (e, struct cache_page, elem);
+	return hash_int (cp->ofs >> PGBITS);
+}
+
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cache_page *a = hash_entry (a_, struct cache_page, elem);
+	const struct cache_page *b = hash_entry (b_, struct cache_page, elem);
+	return a->ofs < b->ofs;
+}
+
+/* Initializes the page cache. */
 void
-pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+page_cache_init (void) {
+	lock_init (&cache_lock);
 }
 
-/* Initialize the page cache */
+/* Initializes CACHE as the empty page cache of an inode.  Returns
+ * false if memory allocation fails. */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
-	/* Set up the handler */
-	page->operations = &page_cache_op;
+page_cache_create (struct hash *cache) {
+	return hash_init (cache, cache_hash, cache_less, NULL);
+}
+
+/* Frees CACHE and the pages in it, when its inode is closed for the
+ * last time. */
+void
+page_cache_destroy (struct hash *cache) {
+	for (;;) {
+		struct cache_page *cp = NULL;
+		struct hash_iterator i;
 
+		lock_acquire (&cache_lock);
+		hash_first (&i, cache);
+		if (hash_next (&i)) {
+			cp = hash_entry (hash_cur (&i), struct cache_page, elem);
+			cp->ref_cnt++;
+		}
+		lock_release (&cache_lock);
+		if (cp == NULL)
+			break;
+
+		vm_cache_drop (cp);
+		page_cache_put (cp);
+	}
+	hash_destroy (cache, NULL);
 }
 
-/* Utilze the Swap in mechanism to implement readhead */
-static bool
-page_cache_readahead (struct page *page, void *kva) {
+/* Returns the cache page of INODE at OFFSET, which must be page-
+ * aligned, holding a reference to it, or NULL if an existing page
+ * is wanted and there is none or if out of memory.  Creates the page
+ * if CREATE. */
+static struct cache_page *
+lookup (struct inode *inode, off_t ofs, bool create) {
+	struct hash *cache = inode_page_cache (inode);
+	struct cache_page *cp = NULL;
+	struct cache_page probe;
+	struct hash_elem *e;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	probe.ofs = ofs;
+	lock_acquire (&cache_lock);
+	e = hash_find (cache, &probe.elem);
+	if (e != NULL)
+		cp = hash_entry (e, struct cache_page, elem);
+	else if (create && (cp = malloc (sizeof *cp)) != NULL) {
+		cp->inode = inode;
+		cp->ofs = ofs;
+		cp->ref_cnt = 0;
+		cp->frame = NULL;
+		cp->loading = false;
+		cp->accessed = false;
+		hash_insert (cache, &cp->elem);
+	}
+	if (cp != NULL)
+		cp->ref_cnt++;
+	lock_release (&cache_lock);
+	return cp;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
-static bool
-page_cache_writeback (struct page *page) {
+/* Returns the cache page of INODE at OFFSET, which must be page-
+ * aligned, creating it if needed, and holds a reference to it.
+ * Returns NULL if out of memory. */
+struct cache_page *
+page_cache_get (struct inode *inode, off_t ofs) {
+	return lookup (inode, ofs, true);
+}
+
+/* Adds a reference to CP. */
+void
+page_cache_hold (struct cache_page *cp) {
+	lock_acquire (&cache_lock);
+	cp->ref_cnt++;
+	lock_release (&cache_lock);
+}
+
+/* Drops a reference to CP, and frees it if that was the last. */
+void
+page_cache_put (struct cache_page *cp) {
+	lock_acquire (&cache_lock);
+	ASSERT (cp->ref_cnt > 0);
+	if (--cp->ref_cnt == 0) {
+		ASSERT (cp->frame == NULL);
+		hash_delete (inode_page_cache (cp->inode), &cp->elem);
+		free (cp);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Reads CNT pages of CP's file, starting at CP's, into the pages
+ * at KVAS[], zeroing what lies past the end of the file.  Returns
+ * false if a read fails. */
+bool
+page_cache_load (struct cache_page *cp, void *const kvas[], size_t cnt) {
+	off_t length = inode_length (cp->inode);
+	off_t want = length > cp->ofs ? length - cp->ofs : 0;
+
+	if (want > (off_t) (cnt * PGSIZE))
+		want = cnt * PGSIZE;
+	return inode_read_pages (cp->inode, kvas, cnt, cp->ofs) == want;
+}
+
+/* Writes the data of CP, at KVA, back to its file. */
+void
+page_cache_write_back (struct cache_page *cp, const void *kva) {
+	inode_write_page (cp->inode, kva, cp->ofs);
 }
 
-/* Destory the page_cache. */
-static void
-page_cache_destroy (struct page *page) {
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET,
+ * through the page cache.  Returns the number of bytes read, which
+ * is less than SIZE at end of file or if an error occurs. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t length = inode_length (inode);
+	off_t bytes_read = 0;
+
+	if (offset < 0 || offset >= length || size <= 0)
+		return 0;
+	if (size > length - offset)
+		size = length - offset;
+
+	while (bytes_read < size) {
+		struct cache_page *cps[READ_BATCH];
+		off_t page_ofs = ROUND_DOWN (offset + bytes_read, PGSIZE);
+		size_t cnt = DIV_ROUND_UP (offset + size - page_ofs, PGSIZE);
+		size_t got, i;
+		bool ok = true;
+
+		if (cnt > READ_BATCH)
+			cnt = READ_BATCH;
+		for (got = 0; got < cnt; got++) {
+			cps[got] = page_cache_get (inode, page_ofs + got * PGSIZE);
+			if (cps[got] == NULL)
+				break;
+		}
+		if (got == 0)
+			break;
+
+		/* Read all the missing pages first, in as few requests as
+		 * possible, then copy. */
+		vm_cache_fill (cps, got);
+		for (i = 0; i < got && ok; i++) {
+			off_t page_pos = offset + bytes_read - cps[i]->ofs;
+			off_t chunk = PGSIZE - page_pos;
+			struct frame *frame = vm_cache_pin (cps[i], true);
+
+			if (chunk > size - bytes_read)
+				chunk = size - bytes_read;
+			if (frame == NULL) {
+				ok = false;
+				break;
+			}
+			memcpy (buffer + bytes_read, (uint8_t *) frame->kva + page_pos, chunk);
+			vm_unpin_frame (frame);
+			bytes_read += chunk;
+		}
+		for (i = 0; i < got; i++)
+			page_cache_put (cps[i]);
+		if (!ok)
+			break;
+	}
+	return bytes_read;
 }
 
-/* Worker thread for page cache */
-static void
-page_cache_kworkerd (void *aux) {
+/* Copies SIZE bytes from BUFFER, which were just written to INODE
+ * at OFFSET, into the pages of INODE's cache that are in memory. */
+void
+page_cache_update (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t done = 0;
+
+	while (done < size) {
+		off_t page_ofs = ROUND_DOWN (offset + done, PGSIZE);
+		off_t page_pos = offset + done - page_ofs;
+		off_t chunk = PGSIZE - page_pos;
+		struct cache_page *cp = lookup (inode, page_ofs, false);
+
+		if (chunk > size - done)
+			chunk = size - done;
+		if (cp != NULL) {
+			struct frame *frame = vm_cache_pin (cp, false);
+
+			if (frame != NULL) {
+				memcpy ((uint8_t *) frame->kva + page_pos, buffer + done, chunk);
+				vm_unpin_frame (frame);
+			}
+			page_cache_put (cp);
+		}
+		done += chunk;
+	}
 }
+#endif /* VM */
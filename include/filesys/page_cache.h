@@ -1,12 +1,39 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
 
-struct page;
-enum vm_type;
+struct frame;
+struct inode;
 
-struct page_cache {};
+/* A page of a file's data in the page cache.  See page_cache.c. */
+struct cache_page {
+	struct hash_elem elem;      /* Element in the inode's cache. */
+	struct inode *inode;        /* File the page belongs to. */
+	off_t ofs;                  /* Offset of the page in INODE. */
+	int ref_cnt;                /* Users, plus one if it has a frame. */
+
+	/* Protected by the frame table lock in vm.c. */
+	struct frame *frame;        /* Frame holding the data, or null. */
+	bool loading;               /* Being read into a new frame? */
+	bool accessed;              /* Read or written since the clock passed? */
+};
 
 void page_cache_init (void);
-bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
-#endif
+bool page_cache_create (struct hash *);
+void page_cache_destroy (struct hash *);
+
+struct cache_page *page_cache_get (struct inode *, off_t ofs);
+void page_cache_hold (struct cache_page *);
+void page_cache_put (struct cache_page *);
+
+bool page_cache_load (struct cache_page *, void *const kvas[], size_t cnt);
+void page_cache_write_back (struct cache_page *, const void *kva);
+
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset);
+void page_cache_update (struct inode *, const void *, off_t size,
+		off_t offset);
+
+#endif /* filesys/page_cache.h */
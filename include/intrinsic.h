@@ -11,6 +11,45 @@ static __inline void lcr3(uint64_t val) {
 	__asm __volatile("movq %0, %%cr3" : : "r" (val));
 }
 
+/* Store VAL into CR0, the register that holds the basic mode
+   bits of the processor, such as paging and write protection.
+   See [IA32-v3a] 2.5 "Control Registers". */
+__attribute__((always_inline))
+static __inline void lcr0(uint64_t val) {
+	__asm __volatile("movq %0, %%cr0" : : "r" (val));
+}
+
+__attribute__((always_inline))
+static __inline uint64_t rcr0(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr0,%0" : "=r" (val));
+	return val;
+}
+
+/* Store VAL into CR4, the register that enables architectural
+   extensions such as global pages and process-context identifiers.
+   See [IA32-v3a] 2.5 "Control Registers". */
+__attribute__((always_inline))
+static __inline void lcr4(uint64_t val) {
+	__asm __volatile("movq %0, %%cr4" : : "r" (val));
+}
+
+__attribute__((always_inline))
+static __inline uint64_t rcr4(void) {
+	uint64_t val;
+	__asm __volatile("movq %%cr4,%0" : "=r" (val));
+	return val;
+}
+
+/* Executes CPUID for LEAF (and sub-leaf 0) and stores the four
+   result registers into REGS as { eax, ebx, ecx, edx }. */
+__attribute__((always_inline))
+static __inline void cpuid(uint32_t leaf, uint32_t regs[4]) {
+	__asm __volatile("cpuid"
+			: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+			: "a" (leaf), "c" (0));
+}
+
 __attribute__((always_inline))
 static __inline void lgdt(const struct desc_ptr *dtr) {
 	__asm __volatile("lgdt %0" : : "m" (*dtr));
@@ -119,6 +158,15 @@ static __inline uint64_t rcr2(void) {
 	return val;
 }
 
+/* Reads the time-stamp counter, which counts processor cycles
+   since reset.  See [IA32-v2b] "RDTSC--Read Time-Stamp Counter". */
+__attribute__((always_inline))
+static __inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (uint64_t) hi << 32 | lo;
+}
+
 __attribute__((always_inline))
 static __inline void write_msr(uint32_t ecx, uint64_t val) {
 	uint32_t edx, eax;
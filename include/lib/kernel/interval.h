@@ -0,0 +1,61 @@
+#ifndef __LIB_KERNEL_INTERVAL_H
+#define __LIB_KERNEL_INTERVAL_H
+
+/* Interval tree.
+ *
+ * A red-black tree of half-open intervals [START, END), ordered by
+ * START, in which each node also records the largest END in its
+ * subtree.  That lets a search skip every subtree that cannot hold
+ * an interval overlapping the one sought, so finding the first
+ * overlapping interval, inserting and removing all take O(log n)
+ * time.  Intervals in the tree may overlap one another.
+ *
+ * Like lists and hash tables, the tree does no dynamic
+ * allocation.  Each structure that can be in an interval tree
+ * embeds a struct interval_elem, and interval_entry() converts a
+ * pointer to it back to a pointer to the structure.  Refer to
+ * lib/kernel/list.h for a detailed explanation. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interval tree element. */
+struct interval_elem {
+	struct interval_elem *parent;
+	struct interval_elem *left;
+	struct interval_elem *right;
+	bool red;                   /* Red or black node? */
+	uint64_t start;             /* First value in the interval. */
+	uint64_t end;               /* One past the last value. */
+	uint64_t max_end;           /* Largest END in this subtree. */
+};
+
+/* Converts pointer to interval element INTERVAL_ELEM into a
+ * pointer to the structure that INTERVAL_ELEM is embedded inside.
+ * Supply the name of the outer structure STRUCT and the member
+ * name MEMBER of the interval element. */
+#define interval_entry(INTERVAL_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) (INTERVAL_ELEM)                \
+		- offsetof (STRUCT, MEMBER)))
+
+/* Interval tree.  All zeros is a valid, empty tree. */
+struct interval_tree {
+	struct interval_elem *root;
+	size_t elem_cnt;            /* Number of elements in the tree. */
+};
+
+void interval_init (struct interval_tree *);
+void interval_insert (struct interval_tree *, struct interval_elem *,
+		uint64_t start, uint64_t end);
+void interval_remove (struct interval_tree *, struct interval_elem *);
+
+struct interval_elem *interval_first (struct interval_tree *,
+		uint64_t start, uint64_t end);
+struct interval_elem *interval_next (struct interval_elem *,
+		uint64_t start, uint64_t end);
+
+size_t interval_size (struct interval_tree *);
+bool interval_empty (struct interval_tree *);
+
+#endif /* lib/kernel/interval.h */
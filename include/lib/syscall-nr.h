@@ -36,6 +36,39 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Give advice about use of memory. */
+};
+
+/* Or'ed into the WRITABLE argument of mmap(): bring in and map the
+   whole range at once, so that using it takes no page faults. */
+#define MAP_POPULATE 0x10
+
+/* Advice for madvise(). */
+enum {
+	MADV_NORMAL,                /* No special treatment. */
+	MADV_RANDOM,                /* Expect page references in random order. */
+	MADV_SEQUENTIAL,            /* Expect page references in order. */
+	MADV_WILLNEED,              /* Will need these pages soon. */
+	MADV_DONTNEED,              /* Will not need these pages soon. */
 };
 
+/* Types of page faults, for get_page_fault_cnt() and
+   get_page_fault_hist(). */
+enum {
+	FAULT_LAZY,                 /* Page read from its file or initialized. */
+	FAULT_ZERO,                 /* Untouched anonymous page. */
+	FAULT_SWAP,                 /* Anonymous page brought back from swap. */
+	FAULT_COW,                  /* Write to a page shared copy-on-write. */
+	FAULT_STACK,                /* Stack growth. */
+	FAULT_FATAL,                /* Invalid access; the process dies. */
+	FAULT_TYPE_CNT
+};
+
+/* Number of buckets in a page fault service time histogram.  Bucket
+   B counts faults that took fewer than 2**B TSC cycles but not
+   fewer than 2**(B-1); the last one also counts all slower ones. */
+#define FAULT_HIST_BUCKETS 40
+
 #endif /* lib/syscall-nr.h */
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -41,6 +42,7 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -78,4 +80,28 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+/* Returns the number of page faults of TYPE, one of the FAULT_*
+   types, taken by all processes, or by this one alone if OWN. */
+static inline long long
+get_page_fault_cnt (int type, bool own) {
+	long long cnt;
+	asm volatile ("int $0x45"
+			: "=a" (cnt)
+			: "d" ((long long) type), "c" (own ? -2LL : -1LL)
+			: "memory");
+	return cnt;
+}
+
+/* Returns the number of page faults of TYPE counted in BUCKET of its
+   service time histogram. */
+static inline long long
+get_page_fault_hist (int type, int bucket) {
+	long long cnt;
+	asm volatile ("int $0x45"
+			: "=a" (cnt)
+			: "d" ((long long) type), "c" ((long long) bucket)
+			: "memory");
+	return cnt;
+}
+
 #endif /* lib/user/syscall.h */
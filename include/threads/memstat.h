@@ -0,0 +1,30 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Allocation counters for one page pool or malloc size class.
+   Updated without locks, from any context, so the counts are
+   exact but IN_USE and PEAK may briefly disagree. */
+struct memstat {
+	uint64_t alloc_cnt;         /* Successful allocations. */
+	uint64_t free_cnt;          /* Frees. */
+	uint64_t fail_cnt;          /* Failed allocations. */
+	size_t in_use;              /* Bytes currently allocated. */
+	size_t peak;                /* Most bytes ever allocated at once. */
+};
+
+/* -memstat-sites: Keep a histogram of allocation call sites? */
+extern bool memstat_sites;
+
+void memstat_alloc (struct memstat *, size_t bytes, void *site);
+void memstat_free (struct memstat *, size_t bytes);
+void memstat_fail (struct memstat *);
+
+void memstat_print (const char *name, const struct memstat *);
+void memstat_print_sites (void);
+void memstat_print_stats (void);
+
+#endif /* threads/memstat.h */
@@ -2,11 +2,24 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
 
+/* Above this many pages, a TLB gather flushes the whole address
+ * space instead of each page. */
+#define TLB_GATHER_MAX 32
+
+/* TLB invalidations for one pml4, gathered to be done at once. */
+struct tlb_gather {
+	uint64_t *pml4;
+	size_t cnt;                 /* Pages gathered. */
+	void *va[TLB_GATHER_MAX];   /* The first TLB_GATHER_MAX of them. */
+};
+
+void mmu_init (void);
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
@@ -14,12 +27,18 @@ void pml4_destroy (uint64_t *pml4);
 void pml4_activate (uint64_t *pml4);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_pages (uint64_t *pml4, void *upage, void *const kpages[],
+		size_t cnt, bool rw);
 void pml4_clear_page (uint64_t *pml4, void *upage);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
 void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
 
+void tlb_gather_init (struct tlb_gather *, uint64_t *pml4);
+void tlb_gather_clear_page (struct tlb_gather *, void *upage);
+void tlb_gather_finish (struct tlb_gather *);
+
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
 #define is_kern_pte(pte) (!is_user_pte (pte))
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -11,7 +12,13 @@ enum palloc_flags {
 	PAL_USER = 004              /* User page. */
 };
 
-/* Maximum number of pages to put in user pool. */
+/* Free-memory watermarks, for reclaim. */
+enum palloc_wmark {
+	WMARK_LOW,                  /* Start reclaiming below this. */
+	WMARK_HIGH                  /* Stop reclaiming at or above this. */
+};
+
+/* Maximum number of pages in use in the user pool. */
 extern size_t user_page_limit;
 
 uint64_t palloc_init (void);
@@ -19,5 +26,7 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_below_wmark (enum palloc_wmark);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -130,6 +130,7 @@ struct thread {
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp;                     /* User rsp at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
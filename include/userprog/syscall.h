@@ -8,7 +8,6 @@ struct lock filesys_lock;
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
-void check_address (void *addr);
 void halt (void);
 void exit (int status);
 tid_t fork (const char *thread_name, struct intr_frame *f);
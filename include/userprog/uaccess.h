@@ -0,0 +1,17 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct intr_frame;
+
+bool access_ok (const void *uaddr, size_t size);
+size_t copy_from_user (void *dst, const void *usrc, size_t size);
+size_t copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
+bool fault_in_user (void *uaddr, size_t size, bool write);
+
+bool fixup_exception (struct intr_frame *);
+
+#endif /* userprog/uaccess.h */
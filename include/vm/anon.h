@@ -1,13 +1,27 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <bitmap.h>
 #include "vm/vm.h"
+#include "vm/zswap.h"
 struct page;
 enum vm_type;
 
+/* Slot of a page that is not on the swap disk. */
+#define SWAP_NONE BITMAP_ERROR
+
+/* Most pages written out or read in with one disk command. */
+#define SWAP_CLUSTER 16
+
 struct anon_page {
+	size_t slot;                /* Swap slot, or SWAP_NONE. */
+	size_t zswap;               /* Compressed copy, or ZSWAP_NONE. */
+	bool file_data;             /* Loaded from a file, not zero-filled? */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void swap_cluster_begin (void);
+void swap_cluster_end (void);
+void anon_swap_share (struct page *page, const struct page *src);
 
 #endif
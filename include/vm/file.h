@@ -1,12 +1,30 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
+struct cache_page;
 struct page;
 enum vm_type;
+struct supplemental_page_table;
+struct thread;
+
+/* A mapping made by mmap(), of a file or of anonymous memory. */
+struct mmap_region {
+	struct file *file;          /* Own handle, or null if anonymous. */
+	void *start;                /* First page of the mapping. */
+	size_t page_cnt;            /* Number of pages mapped. */
+	struct vm_area area;        /* Area in the owner's table. */
+	struct thread *owner;       /* Process that mapped it. */
+	struct list_elem elem;      /* Element in the flusher's list. */
+	bool flushing;              /* Being written back by the flusher? */
+};
 
 struct file_page {
+	struct mmap_region *region; /* Mapping the page belongs to. */
+	off_t ofs;                  /* Offset of the page in the file. */
+	struct cache_page *cache;   /* Page of the file's cache mapped. */
 };
 
 void vm_file_init (void);
@@ -14,4 +32,5 @@ bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+void do_munmap_all (struct supplemental_page_table *spt);
 #endif
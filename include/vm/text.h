@@ -0,0 +1,16 @@
+#ifndef VM_TEXT_H
+#define VM_TEXT_H
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct page;
+enum vm_type;
+struct inode;
+
+bool text_initializer (struct page *, enum vm_type, void *kva);
+bool text_alloc_page (void *upage, struct inode *, off_t ofs);
+bool text_copy_page (struct page *src);
+bool page_is_text (const struct page *);
+
+#endif
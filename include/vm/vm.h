@@ -1,6 +1,11 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <interval.h>
+#include <list.h>
+#include <syscall-nr.h>
+#include "threads/mmu.h"
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -20,17 +25,38 @@ enum vm_type {
 	VM_MARKER_0 = (1 << 3),
 	VM_MARKER_1 = (1 << 4),
 
+	/* Marks a page of the user stack. */
+	VM_STACK = VM_MARKER_0,
+	/* Marks a page of program text shared between processes. */
+	VM_TEXT = VM_MARKER_1,
+
 	/* DO NOT EXCEED THIS VALUE. */
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Kinds of virtual memory areas. */
+enum vma_kind {
+	VMA_PRIVATE,           /* Segment, or memory inherited on fork. */
+	VMA_STACK,             /* Room for the user stack. */
+	VMA_MMAP,              /* Region mapped by mmap(). */
+};
+
+/* A virtual memory area: a range of a process's address space in
+ * which it may have pages.  See vm.c. */
+struct vm_area {
+	struct interval_elem elem;  /* Element in the table's VMAS. */
+	enum vma_kind kind;
+};
+
+#define vma_start(VMA) ((void *) (VMA)->elem.start)
+#define vma_end(VMA) ((void *) (VMA)->elem.end)
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
-#include "filesys/page_cache.h"
-#endif
+#include "vm/text.h"
 
+struct cache_page;
 struct page_operations;
 struct thread;
 
@@ -46,6 +72,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	bool writable;         /* Mapped writable? */
+	struct thread *owner;  /* Process whose address space holds it. */
+	int advice;            /* MADV_* from madvise(). */
+	struct page *rmap_next;  /* Next page mapping the same frame. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -53,18 +83,29 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
-		struct page_cache page_cache;
-#endif
 	};
 };
 
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;         /* First page mapping the frame. */
+	struct list_elem elem;     /* Element in the frame table. */
+	int ref_cnt;               /* Pages mapping the frame. */
+	struct cache_page *cache;  /* File page cached in it, or null. */
+	int pin_cnt;               /* Not evictable while nonzero. */
+	bool evicting;             /* Contents being written out. */
+	unsigned checksum;         /* Contents when last scanned for merging. */
+	struct hash_elem ksm_elem; /* Element in the merge table, if listed. */
+	bool ksm_listed;           /* In the merge table? */
 };
 
+/* The user stack may grow to this size. */
+#define STACK_LIMIT (1 << 20)
+
+/* Most pages resident in any one process, or 0 for no limit. */
+extern size_t rss_limit;
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -82,11 +123,32 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * A radix tree shaped like the x86-64 page table; see vm.c.  All
+ * zeros is a valid, empty table. */
 struct supplemental_page_table {
+	void **root;           /* Top-level node, or null if empty. */
+	size_t page_cnt;       /* Number of pages in the table. */
+	struct interval_tree vmas;  /* Virtual memory areas. */
+
+	/* Fault-around state; see vm.c. */
+	void *fa_next;         /* Next fault expected in a sequential scan. */
+	size_t fa_window;      /* Pages to bring in on the next fault. */
+
+	size_t rss;            /* Pages resident, shared ones included. */
+	uint64_t fault_cnt[FAULT_TYPE_CNT];  /* Page faults of each type. */
+	struct vm_gather *gather;   /* Unmapping in progress, or null. */
 };
 
+/* Unmappings in one address space whose TLB invalidations, and the
+ * freeing of whose frames, wait until vm_gather_end(). */
+struct vm_gather {
+	struct tlb_gather tlb;
+	struct list frames;    /* Frames to free after the flush. */
+};
+
+/* Callback for spt_for_each().  Returning false stops the walk. */
+typedef bool spt_action_func (struct page *, void *aux);
+
 #include "threads/thread.h"
 void supplemental_page_table_init (struct supplemental_page_table *spt);
 bool supplemental_page_table_copy (struct supplemental_page_table *dst,
@@ -96,10 +158,23 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
-
+bool spt_for_each (struct supplemental_page_table *spt, void *start,
+		void *end, spt_action_func *action, void *aux);
+
+void vma_insert (struct supplemental_page_table *, struct vm_area *,
+		void *start, void *end, enum vma_kind);
+bool vma_add (struct supplemental_page_table *, void *start, void *end,
+		enum vma_kind);
+void vma_remove (struct supplemental_page_table *, struct vm_area *);
+struct vm_area *vma_find (struct supplemental_page_table *,
+		const void *start, const void *end);
+struct vm_area *vma_next (struct vm_area *, const void *start,
+		const void *end);
+
+void vm_frame_init (void);
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
-		bool write, bool not_present);
+		bool write, bool not_present, int *type);
 
 #define vm_alloc_page(type, upage, writable) \
 	vm_alloc_page_with_initializer ((type), (upage), (writable), NULL, NULL)
@@ -107,6 +182,19 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_free_frame (struct page *page);
+void vm_gather_begin (struct supplemental_page_table *, struct vm_gather *);
+void vm_gather_end (struct supplemental_page_table *);
+bool vm_install_frame (struct page *page, void *kva);
+struct frame *vm_pin_frame (struct page *page);
+void vm_unpin_frame (struct frame *frame);
+void vm_cache_fill (struct cache_page *cps[], size_t cnt);
+size_t vm_map_cache (struct page *pages[], size_t cnt);
+struct frame *vm_cache_pin (struct cache_page *cp, bool load);
+void vm_cache_drop (struct cache_page *cp);
+int do_madvise (void *addr, size_t length, int advice);
+bool vm_pin_range (const void *addr, size_t size, bool write);
+void vm_unpin_range (const void *addr, size_t size);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Handle of a page that is not in the compressed pool. */
+#define ZSWAP_NONE SIZE_MAX
+
+void zswap_init (void);
+size_t zswap_store (const void *kva);
+void zswap_load (size_t handle, void *kva);
+void zswap_dup (size_t handle);
+void zswap_free (size_t handle);
+void zswap_print_stats (void);
+
+#endif
@@ -26,6 +26,7 @@ typedef unsigned long elem_type;
    simulates an array of bits. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
+	size_t next_fit;    /* Where bitmap_scan_and_flip_next() resumes. */
 	elem_type *bits;    /* Elements that represent bits. */
 };
 
@@ -63,6 +64,54 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns an elem_type with the bits of element ELEM_IDX that
+   fall inside [START, END) turned on.  END must be greater than
+   START. */
+static inline elem_type
+range_mask (size_t elem_idx, size_t start, size_t end) {
+	size_t lo = elem_idx * ELEM_BITS;
+	size_t first = start > lo ? start - lo : 0;
+	size_t last = end - lo < ELEM_BITS ? end - lo : ELEM_BITS;
+	elem_type mask = (elem_type) -1 << first;
+	if (last < ELEM_BITS)
+		mask &= ((elem_type) 1 << last) - 1;
+	return mask;
+}
+
+/* Returns the number of 1-bits in X.  __builtin_popcountl() would
+   turn into a call into libgcc, which the kernel does not link. */
+static inline size_t
+popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's size if there is none.  Elements in
+   which no bit has VALUE are skipped in a single step. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value) {
+	elem_type flip = value ? 0 : (elem_type) -1;
+	size_t idx = elem_idx (start);
+	size_t end = elem_cnt (b->bit_cnt);
+	elem_type word;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	word = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+	while (word == 0) {
+		if (++idx >= end)
+			return b->bit_cnt;
+		word = b->bits[idx] ^ flip;
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzll (word);
+	return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -74,6 +123,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->next_fit = 0;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +144,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	b->next_fit = 0;
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -194,50 +245,57 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but not the range as a
+   whole. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
+	size_t idx;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	if (cnt == 0)
+		return;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++) {
+		elem_type mask = range_mask (idx, start, end);
+		if (value)
+			asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t idx, value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
+	if (cnt == 0)
+		return 0;
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+		value_cnt += popcount (b->bits[idx] & range_mask (idx, start, end));
+	return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -266,18 +324,30 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Rather than testing every candidate start, this jumps to the
+   next bit with VALUE, then to the next bit without it; if that
+   one comes too early the run is too short and the search resumes
+   past it.  Both jumps go an element at a time, so the cost is
+   proportional to the number of elements, not bits times CNT. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt == 0)
+		return start;
+	while (cnt <= b->bit_cnt - start) {
+		size_t run_end;
+
+		start = find_next (b, start, value);
+		if (cnt > b->bit_cnt - start)
+			break;
+		run_end = find_next (b, start, !value);
+		if (run_end - start >= cnt)
+			return start;
+		start = run_end;
 	}
 	return BITMAP_ERROR;
 }
@@ -296,7 +366,26 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
 		bitmap_set_multiple (b, idx, cnt, !value);
 	return idx;
 }
-
+
+/* Like bitmap_scan_and_flip(), but picks up where the previous
+   call on B left off instead of at bit 0 (next fit), wrapping
+   around to the start of B if nothing fits past that point.
+   Allocators that hand out and take back bits all the time then
+   do not rescan the densely used front of B on every call. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) {
+	size_t hint = b->next_fit <= b->bit_cnt ? b->next_fit : 0;
+	size_t idx = bitmap_scan (b, hint, cnt, value);
+
+	if (idx == BITMAP_ERROR && hint > 0)
+		idx = bitmap_scan (b, 0, cnt, value);
+	if (idx != BITMAP_ERROR) {
+		bitmap_set_multiple (b, idx, cnt, !value);
+		b->next_fit = idx + cnt;
+	}
+	return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -0,0 +1,318 @@
+/* Interval tree.
+
+   See interval.h for basic information.  The balancing is that of
+   the red-black trees in CLRS, "Introduction to Algorithms",
+   with null pointers for leaves.  Whatever changes a node's
+   subtree also recomputes its MAX_END. */
+
+#include "interval.h"
+#include "../debug.h"
+
+/* Recomputes E's MAX_END from its interval and its children. */
+static void
+update (struct interval_elem *e) {
+	uint64_t max_end = e->end;
+
+	if (e->left != NULL && e->left->max_end > max_end)
+		max_end = e->left->max_end;
+	if (e->right != NULL && e->right->max_end > max_end)
+		max_end = e->right->max_end;
+	e->max_end = max_end;
+}
+
+/* Recomputes MAX_END for E and all of its ancestors. */
+static void
+update_path (struct interval_elem *e) {
+	for (; e != NULL; e = e->parent)
+		update (e);
+}
+
+/* Returns true if E is a red node, false if it is black or a
+   leaf. */
+static bool
+is_red (const struct interval_elem *e) {
+	return e != NULL && e->red;
+}
+
+/* Makes NEW take OLD's place as a child of OLD's parent, or as
+   the root of T. */
+static void
+replace_child (struct interval_tree *t, struct interval_elem *old,
+		struct interval_elem *new) {
+	if (old->parent == NULL)
+		t->root = new;
+	else if (old == old->parent->left)
+		old->parent->left = new;
+	else
+		old->parent->right = new;
+}
+
+/* Rotates E's right child up into E's place. */
+static void
+rotate_left (struct interval_tree *t, struct interval_elem *e) {
+	struct interval_elem *r = e->right;
+
+	e->right = r->left;
+	if (r->left != NULL)
+		r->left->parent = e;
+	replace_child (t, e, r);
+	r->parent = e->parent;
+	r->left = e;
+	e->parent = r;
+	update (e);
+	update (r);
+}
+
+/* Rotates E's left child up into E's place. */
+static void
+rotate_right (struct interval_tree *t, struct interval_elem *e) {
+	struct interval_elem *l = e->left;
+
+	e->left = l->right;
+	if (l->right != NULL)
+		l->right->parent = e;
+	replace_child (t, e, l);
+	l->parent = e->parent;
+	l->right = e;
+	e->parent = l;
+	update (e);
+	update (l);
+}
+
+/* Initializes T as an empty interval tree. */
+void
+interval_init (struct interval_tree *t) {
+	t->root = NULL;
+	t->elem_cnt = 0;
+}
+
+/* Inserts E into T as the interval [START, END). */
+void
+interval_insert (struct interval_tree *t, struct interval_elem *e,
+		uint64_t start, uint64_t end) {
+	struct interval_elem **link = &t->root;
+	struct interval_elem *parent = NULL;
+
+	ASSERT (start <= end);
+
+	while (*link != NULL) {
+		parent = *link;
+		link = start < parent->start ? &parent->left : &parent->right;
+	}
+	e->parent = parent;
+	e->left = e->right = NULL;
+	e->red = true;
+	e->start = start;
+	e->end = end;
+	e->max_end = end;
+	*link = e;
+	update_path (parent);
+	t->elem_cnt++;
+
+	/* Restore the red-black properties. */
+	while (is_red (e->parent)) {
+		struct interval_elem *p = e->parent;
+		struct interval_elem *g = p->parent;
+
+		if (p == g->left) {
+			struct interval_elem *u = g->right;
+
+			if (is_red (u)) {
+				p->red = u->red = false;
+				g->red = true;
+				e = g;
+				continue;
+			}
+			if (e == p->right) {
+				rotate_left (t, p);
+				p = e;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_right (t, g);
+			break;
+		} else {
+			struct interval_elem *u = g->left;
+
+			if (is_red (u)) {
+				p->red = u->red = false;
+				g->red = true;
+				e = g;
+				continue;
+			}
+			if (e == p->left) {
+				rotate_right (t, p);
+				p = e;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_left (t, g);
+			break;
+		}
+	}
+	t->root->red = false;
+}
+
+/* Restores the red-black properties after the removal of a black
+   node left X, which may be a leaf, with one black node too few
+   on its paths.  PARENT is X's parent. */
+static void
+remove_fixup (struct interval_tree *t, struct interval_elem *x,
+		struct interval_elem *parent) {
+	while (x != t->root && !is_red (x)) {
+		if (x == parent->left) {
+			struct interval_elem *w = parent->right;
+
+			if (is_red (w)) {
+				w->red = false;
+				parent->red = true;
+				rotate_left (t, parent);
+				w = parent->right;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!is_red (w->right)) {
+				w->left->red = false;
+				w->red = true;
+				rotate_right (t, w);
+				w = parent->right;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->right->red = false;
+			rotate_left (t, parent);
+		} else {
+			struct interval_elem *w = parent->left;
+
+			if (is_red (w)) {
+				w->red = false;
+				parent->red = true;
+				rotate_right (t, parent);
+				w = parent->left;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!is_red (w->left)) {
+				w->right->red = false;
+				w->red = true;
+				rotate_left (t, w);
+				w = parent->left;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->left->red = false;
+			rotate_right (t, parent);
+		}
+		x = t->root;
+	}
+	if (x != NULL)
+		x->red = false;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+interval_remove (struct interval_tree *t, struct interval_elem *e) {
+	struct interval_elem *y, *x, *parent;
+	bool removed_red;
+
+	/* Y is the node that actually leaves its place: E itself if it
+	   has a leaf child, otherwise its successor, which then takes
+	   E's place.  X takes Y's place. */
+	y = e;
+	if (e->left != NULL && e->right != NULL)
+		for (y = e->right; y->left != NULL; y = y->left)
+			continue;
+	x = y->left != NULL ? y->left : y->right;
+	parent = y->parent;
+	removed_red = y->red;
+	if (x != NULL)
+		x->parent = parent;
+	replace_child (t, y, x);
+
+	if (y != e) {
+		if (parent == e)
+			parent = y;
+		y->left = e->left;
+		y->right = e->right;
+		y->parent = e->parent;
+		y->red = e->red;
+		replace_child (t, e, y);
+		if (y->left != NULL)
+			y->left->parent = y;
+		if (y->right != NULL)
+			y->right->parent = y;
+	}
+	update_path (parent);
+	t->elem_cnt--;
+
+	if (!removed_red)
+		remove_fixup (t, x, parent);
+}
+
+/* Returns true if E overlaps [START, END). */
+static bool
+overlaps (const struct interval_elem *e, uint64_t start, uint64_t end) {
+	return e->start < end && e->end > start;
+}
+
+/* Returns the element of T with the lowest START that overlaps
+   [START, END), or a null pointer if there is none. */
+struct interval_elem *
+interval_first (struct interval_tree *t, uint64_t start, uint64_t end) {
+	struct interval_elem *e = t->root;
+
+	while (e != NULL && e->max_end > start) {
+		/* Every interval on the left starts at or before E's, so
+		   if one there reaches past START and E starts before END,
+		   that one overlaps, and comes first. */
+		if (e->left != NULL && e->left->max_end > start)
+			e = e->left;
+		else if (overlaps (e, start, end))
+			return e;
+		else if (e->start >= end)
+			return NULL;
+		else
+			e = e->right;
+	}
+	return NULL;
+}
+
+/* Returns the element after E, in order of START, that overlaps
+   [START, END), or a null pointer if there is none. */
+struct interval_elem *
+interval_next (struct interval_elem *e, uint64_t start, uint64_t end) {
+	for (;;) {
+		if (e->right != NULL)
+			for (e = e->right; e->left != NULL; e = e->left)
+				continue;
+		else {
+			while (e->parent != NULL && e == e->parent->right)
+				e = e->parent;
+			e = e->parent;
+		}
+		if (e == NULL || e->start >= end)
+			return NULL;
+		if (overlaps (e, start, end))
+			return e;
+	}
+}
+
+/* Returns the number of elements in T. */
+size_t
+interval_size (struct interval_tree *t) {
+	return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+interval_empty (struct interval_tree *t) {
+	return t->elem_cnt == 0;
+}
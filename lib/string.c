@@ -1,5 +1,93 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Block moves.
+
+   The byte loops below are fine for a handful of bytes but are
+   what page copies, page zeroing and sector copies end up in, so
+   anything of BLOCK_MIN bytes or more uses the string
+   instructions instead.  On CPUs with Enhanced REP MOVSB/STOSB
+   (ERMS) the byte forms are as fast as the quadword forms and
+   handle alignment in microcode; elsewhere we align DST by hand
+   and move quadwords.  This file is linked into user programs as
+   well, so it detects ERMS with CPUID instead of relying on any
+   kernel state. */
+#define BLOCK_MIN 32
+
+/* Repeats byte 0x01 in every byte of a word.  Multiplying a byte
+   by it fills a word with that byte. */
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Nonzero if word X contains a zero byte. */
+#define HAS_ZERO(X) (((X) - ONES) & ~(X) & HIGHS)
+
+/* A 64-bit word that may alias any object and sit at any
+   address, for the word-at-a-time loops below. */
+typedef uint64_t __attribute__ ((may_alias, aligned (1))) word_t;
+
+/* True if the CPU has ERMS (CPUID.(EAX=7,ECX=0):EBX bit 9). */
+static bool
+has_erms (void) {
+	static int erms = -1;
+
+	if (erms < 0) {
+		uint32_t eax, ebx, ecx, edx;
+
+		asm volatile ("cpuid"
+				: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+				: "a" (0), "c" (0));
+		if (eax >= 7)
+			asm volatile ("cpuid"
+					: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+					: "a" (7), "c" (0));
+		else
+			ebx = 0;
+		erms = (ebx >> 9) & 1;
+	}
+	return erms;
+}
+
+/* Copies SIZE bytes from SRC to DST with string instructions. */
+static void
+block_copy (unsigned char *dst, const unsigned char *src, size_t size) {
+	if (!has_erms ()) {
+		size_t head = -(uintptr_t) dst & 7;
+		size_t words;
+
+		size -= head;
+		asm volatile ("rep movsb"
+				: "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+		words = size / 8;
+		size %= 8;
+		asm volatile ("rep movsq"
+				: "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+	}
+	asm volatile ("rep movsb"
+			: "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
+
+/* Sets SIZE bytes at DST to VALUE with string instructions. */
+static void
+block_set (unsigned char *dst, int value, size_t size) {
+	if (!has_erms ()) {
+		uint64_t fill = (unsigned char) value * ONES;
+		size_t head = -(uintptr_t) dst & 7;
+		size_t words;
+
+		size -= head;
+		asm volatile ("rep stosb"
+				: "+D" (dst), "+c" (head) : "a" (fill) : "memory");
+		words = size / 8;
+		size %= 8;
+		asm volatile ("rep stosq"
+				: "+D" (dst), "+c" (words) : "a" (fill) : "memory");
+	}
+	asm volatile ("rep stosb"
+			: "+D" (dst), "+c" (size) : "a" (value) : "memory");
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +99,11 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	if (size >= BLOCK_MIN)
+		block_copy (dst, src, size);
+	else
+		while (size-- > 0)
+			*dst++ = *src++;
 
 	return dst_;
 }
@@ -52,6 +143,11 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip over equal words; the byte loop then finds the
+	   differing byte within the first unequal word, if any. */
+	for (; size >= 8; a += 8, b += 8, size -= 8)
+		if (*(const word_t *) a != *(const word_t *) b)
+			break;
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -260,8 +356,11 @@ memset (void *dst_, int value, size_t size) {
 
 	ASSERT (dst != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = value;
+	if (size >= BLOCK_MIN)
+		block_set (dst, value, size);
+	else
+		while (size-- > 0)
+			*dst++ = value;
 
 	return dst_;
 }
@@ -270,10 +369,19 @@ memset (void *dst_, int value, size_t size) {
 size_t
 strlen (const char *string) {
 	const char *p;
+	const word_t *w;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
+	/* Go byte by byte up to a word boundary, then a word at a
+	   time.  Aligned words never cross a page boundary, so this
+	   reads nothing the byte loop would not have faulted on. */
+	for (p = string; (uintptr_t) p & 7; p++)
+		if (*p == '\0')
+			return p - string;
+	for (w = (const word_t *) p; !HAS_ZERO (*w); w++)
+		continue;
+	for (p = (const char *) w; *p != '\0'; p++)
 		continue;
 	return p - string;
 }
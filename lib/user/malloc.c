@@ -0,0 +1,283 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A memory allocator for user programs.
+
+   Memory comes from the kernel through anonymous mmap(), which gives
+   a page a frame only when it is first touched, so address space
+   mapped but not used yet costs next to nothing.
+
+   A request of up to MAX_SMALL bytes is rounded up to a power of
+   two, at least MIN_SIZE, and served from the free list of that
+   size class.  If the free list is empty, the block is carved from
+   the class's current span instead, and a new span is mapped when
+   that one is used up.  Spans are SPAN_SIZE bytes, aligned to
+   SPAN_SIZE, and laid out upward from SMALL_BASE.  Each starts with
+   a header giving its class, so free() finds a block's class by
+   rounding its address down to the span, and puts the block back on
+   that class's free list.  Small blocks are never returned to the
+   kernel.
+
+   A larger request is mapped by itself from LARGE_BASE up, preceded
+   by a header giving its size, and free() gives it back with
+   munmap().  The address space is then kept as a hole for later
+   large blocks, merged with the holes next to it.
+
+   A user process has only one thread, so the free lists are its
+   thread cache as they stand, with nothing to lock. */
+
+#define PAGE_SIZE 4096
+#define SPAN_SIZE (16 * PAGE_SIZE)      /* Unit of small block memory. */
+#define SMALL_BASE 0x20000000           /* Start of small block spans. */
+#define LARGE_BASE 0x30000000           /* Start of large blocks. */
+#define HEAP_LIMIT 0x40000000           /* End of the heap. */
+
+#define MIN_SIZE 16                     /* Smallest block. */
+#define CLASS_CNT 8                     /* Number of size classes. */
+#define MAX_SMALL (MIN_SIZE << (CLASS_CNT - 1))
+
+/* Header at the start of a span or a large block. */
+struct header {
+	size_t size;        /* Bytes in the block, or in each of the span's. */
+	size_t class;       /* Size class, for a span. */
+};
+
+/* Room for the header, keeping blocks 16-byte aligned. */
+#define HEADER_SIZE 16
+
+/* A block on a free list. */
+struct block {
+	struct block *next;
+};
+
+/* Small blocks. */
+static struct block *free_lists[CLASS_CNT];
+static uint8_t *carve_next[CLASS_CNT];  /* Next block in the span. */
+static uint8_t *carve_end[CLASS_CNT];   /* End of the span. */
+static uintptr_t span_next = SMALL_BASE;  /* Next span to map. */
+
+/* Address space left by large blocks, for reuse. */
+struct hole {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+#define HOLE_CNT 64
+static struct hole holes[HOLE_CNT];
+static size_t hole_cnt;
+
+/* Large block address space is unused from here up. */
+static uintptr_t large_next = LARGE_BASE;
+
+/* Returns the size class for a block of SIZE bytes. */
+static size_t
+size_class (size_t size) {
+	if (size <= MIN_SIZE)
+		return 0;
+	return 64 - __builtin_clzl (size - 1) - 4;
+}
+
+/* Returns the header for block P. */
+static struct header *
+header_of (void *p) {
+	uintptr_t addr = (uintptr_t) p;
+
+	if (addr < LARGE_BASE)
+		return (struct header *) ROUND_DOWN (addr, SPAN_SIZE);
+	return (struct header *) (addr - HEADER_SIZE);
+}
+
+/* Maps LENGTH bytes of anonymous memory at the first address from
+   *NEXT, in steps of LENGTH, that is free, but not past LIMIT.
+   Advances *NEXT past the mapping.  Returns the mapping, or a null
+   pointer if there is no room. */
+static void *
+map_next (uintptr_t *next, uintptr_t limit, size_t length) {
+	while (length <= limit - *next) {
+		uintptr_t start = *next;
+
+		/* If the program has mapped something of its own here,
+		   mmap() fails and we go on past it. */
+		*next += length;
+		if (mmap ((void *) start, length, true, -1, 0) != MAP_FAILED)
+			return (void *) start;
+	}
+	return NULL;
+}
+
+/* Allocates a block of size class CLASS. */
+static void *
+small_alloc (size_t class) {
+	size_t size = MIN_SIZE << class;
+	struct block *b = free_lists[class];
+	struct header *span;
+	void *p;
+
+	if (b != NULL) {
+		free_lists[class] = b->next;
+		return b;
+	}
+
+	if ((size_t) (carve_end[class] - carve_next[class]) < size) {
+		span = map_next (&span_next, LARGE_BASE, SPAN_SIZE);
+		if (span == NULL)
+			return NULL;
+		span->size = size;
+		span->class = class;
+		carve_next[class] = (uint8_t *) span + HEADER_SIZE;
+		carve_end[class] = (uint8_t *) span + SPAN_SIZE;
+	}
+	p = carve_next[class];
+	carve_next[class] += size;
+	return p;
+}
+
+/* Allocates a large block of SIZE bytes. */
+static void *
+large_alloc (size_t size) {
+	struct header *h = NULL;
+	size_t length, i;
+
+	if (size > HEAP_LIMIT - LARGE_BASE)
+		return NULL;
+	length = ROUND_UP (HEADER_SIZE + size, PAGE_SIZE);
+
+	for (i = 0; i < hole_cnt; i++)
+		if (holes[i].end - holes[i].start >= length
+				&& mmap ((void *) holes[i].start, length, true, -1, 0)
+				!= MAP_FAILED) {
+			h = (struct header *) holes[i].start;
+			holes[i].start += length;
+			if (holes[i].start == holes[i].end)
+				holes[i] = holes[--hole_cnt];
+			break;
+		}
+	if (h == NULL)
+		h = map_next (&large_next, HEAP_LIMIT, length);
+	if (h == NULL)
+		return NULL;
+	h->size = length - HEADER_SIZE;
+	return (uint8_t *) h + HEADER_SIZE;
+}
+
+/* Unmaps large block H and keeps its address space for reuse,
+   merged with the holes next to it.  If there are too many holes
+   to remember, the smallest is forgotten. */
+static void
+large_free (struct header *h) {
+	uintptr_t start = (uintptr_t) h;
+	uintptr_t end = start + HEADER_SIZE + h->size;
+	size_t i, smallest;
+
+	munmap (h);
+	for (i = 0; i < hole_cnt; ) {
+		if (holes[i].end == start || holes[i].start == end) {
+			start = holes[i].start < start ? holes[i].start : start;
+			end = holes[i].end > end ? holes[i].end : end;
+			holes[i] = holes[--hole_cnt];
+		} else
+			i++;
+	}
+	if (end == large_next) {
+		large_next = start;
+		return;
+	}
+
+	if (hole_cnt == HOLE_CNT) {
+		smallest = 0;
+		for (i = 1; i < hole_cnt; i++)
+			if (holes[i].end - holes[i].start
+					< holes[smallest].end - holes[smallest].start)
+				smallest = i;
+		if (holes[smallest].end - holes[smallest].start >= end - start)
+			return;
+		holes[smallest] = holes[--hole_cnt];
+	}
+	holes[hole_cnt].start = start;
+	holes[hole_cnt].end = end;
+	hole_cnt++;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available or if SIZE
+   is 0. */
+void *
+malloc (size_t size) {
+	if (size == 0)
+		return NULL;
+	if (size <= MAX_SMALL)
+		return small_alloc (size_class (size));
+	return large_alloc (size);
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b) {
+	void *p;
+	size_t size;
+
+	/* Calculate block size and make sure it fits in size_t. */
+	size = a * b;
+	if (b != 0 && size / b != a)
+		return NULL;
+
+	/* Allocate and zero memory. */
+	p = malloc (size);
+	if (p != NULL)
+		memset (p, 0, size);
+
+	return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly moving
+   it in the process.
+   If successful, returns the new block; on failure, returns a null
+   pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size) {
+	void *new_block;
+	size_t old_size;
+
+	if (new_size == 0) {
+		free (old_block);
+		return NULL;
+	}
+	if (old_block == NULL)
+		return malloc (new_size);
+
+	old_size = header_of (old_block)->size;
+	if (new_size <= old_size)
+		return old_block;
+	new_block = malloc (new_size);
+	if (new_block != NULL) {
+		memcpy (new_block, old_block, old_size);
+		free (old_block);
+	}
+	return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p) {
+	struct block *b = p;
+	struct header *h;
+
+	if (p == NULL)
+		return;
+	h = header_of (p);
+	if ((uintptr_t) p >= LARGE_BASE) {
+		large_free (h);
+		return;
+	}
+	ASSERT (h->class < CLASS_CNT);
+	b->next = free_lists[h->class];
+	free_lists[h->class] = b;
+}
@@ -0,0 +1,142 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count() and bitmap_contains()
+   against a straightforward bit-at-a-time reference on large,
+   randomly fragmented bitmaps, then times both.  The bitmaps are
+   the size of the page pools and swap slot maps of a machine with
+   a few hundred MB of RAM.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in each bitmap we test. */
+#define BIT_CNT (64 * 1024)
+
+/* Number of searches timed per bitmap. */
+#define SCAN_CNT 200
+
+static void fragment (struct bitmap *, int percent_used);
+static size_t reference_scan (const struct bitmap *, size_t start,
+                              size_t cnt, bool value);
+static void verify (const struct bitmap *);
+static void benchmark (const struct bitmap *, int percent_used);
+
+/* Test and time the bitmap scanning implementation. */
+void
+test (void) 
+{
+  static const int densities[] = {0, 50, 90, 99};
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t i;
+
+  ASSERT (b != NULL);
+  for (i = 0; i < sizeof densities / sizeof *densities; i++)
+    {
+      fragment (b, densities[i]);
+      verify (b);
+      benchmark (b, densities[i]);
+    }
+  bitmap_destroy (b);
+  printf ("bitmap: PASS\n");
+}
+
+/* Sets a random PERCENT_USED percent of the bits in B, in runs of
+   random length, the way a long-running page allocator leaves
+   its pool. */
+static void
+fragment (struct bitmap *b, int percent_used) 
+{
+  size_t i = 0;
+
+  bitmap_set_all (b, false);
+  while (i < BIT_CNT)
+    {
+      size_t run = random_ulong () % 16 + 1;
+      if (run > BIT_CNT - i)
+        run = BIT_CNT - i;
+      if ((int) (random_ulong () % 100) < percent_used)
+        bitmap_set_multiple (b, i, run, true);
+      i += run;
+    }
+}
+
+/* The original bitmap_scan(): tests every candidate start bit. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Compares the word-at-a-time routines against the reference. */
+static void
+verify (const struct bitmap *b) 
+{
+  int i;
+
+  for (i = 0; i < SCAN_CNT; i++)
+    {
+      size_t start = random_ulong () % BIT_CNT;
+      size_t cnt = random_ulong () % 32 + 1;
+      bool value = random_ulong () % 2;
+      size_t j, expected = 0;
+
+      ASSERT (bitmap_scan (b, start, cnt, value)
+              == reference_scan (b, start, cnt, value));
+
+      if (start + cnt > BIT_CNT)
+        continue;
+      for (j = start; j < start + cnt; j++)
+        expected += bitmap_test (b, j) == value;
+      ASSERT (bitmap_count (b, start, cnt, value) == expected);
+      ASSERT (bitmap_contains (b, start, cnt, value) == (expected > 0));
+    }
+}
+
+/* Times SCAN_CNT first-fit searches for runs of free bits with
+   both implementations and prints the timer ticks each took. */
+static void
+benchmark (const struct bitmap *b, int percent_used) 
+{
+  static const size_t run_lengths[] = {1, 4, 32};
+  size_t i;
+
+  for (i = 0; i < sizeof run_lengths / sizeof *run_lengths; i++)
+    {
+      size_t cnt = run_lengths[i];
+      int64_t start;
+      int64_t fast, slow;
+      int j;
+
+      start = timer_ticks ();
+      for (j = 0; j < SCAN_CNT; j++)
+        bitmap_scan (b, 0, cnt, false);
+      fast = timer_elapsed (start);
+
+      start = timer_ticks ();
+      for (j = 0; j < SCAN_CNT; j++)
+        reference_scan (b, 0, cnt, false);
+      slow = timer_elapsed (start);
+
+      printf ("%3d%% used, run of %2zu: word scan %lld ticks, "
+              "bit scan %lld ticks\n", percent_used, cnt, fast, slow);
+    }
+}
@@ -0,0 +1,193 @@
+/* Test program for lib/kernel/interval.c.
+
+   Inserts and removes random intervals, many of them overlapping
+   or sharing a start, and after every change checks the red-black
+   and MAX_END invariants of the whole tree and compares random
+   overlap queries against a linear scan of the intervals in it.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <interval.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Number of intervals we have to insert. */
+#define ELEM_CNT 256
+
+/* Number of inserts and removes per round. */
+#define OP_CNT 4096
+
+/* Overlap queries checked after each insert or remove. */
+#define QUERY_CNT 4
+
+/* An interval, in the tree or not. */
+struct value
+  {
+    struct interval_elem elem;  /* Interval tree element. */
+    bool in_tree;               /* Currently in the tree? */
+  };
+
+static struct value values[ELEM_CNT];
+
+static void random_interval (uint64_t range, uint64_t *start,
+                             uint64_t *end);
+static int verify_subtree (const struct interval_elem *,
+                           const struct interval_elem *parent);
+static void verify_tree (struct interval_tree *);
+static void verify_query (struct interval_tree *, uint64_t start,
+                          uint64_t end);
+
+/* Test the interval tree implementation. */
+void
+test (void)
+{
+  /* Small ranges make for many overlaps and equal starts. */
+  static const uint64_t ranges[] = {16, 256, 1 << 20};
+  size_t r;
+
+  for (r = 0; r < sizeof ranges / sizeof *ranges; r++)
+    {
+      struct interval_tree tree;
+      int op, i;
+
+      interval_init (&tree);
+      for (i = 0; i < ELEM_CNT; i++)
+        values[i].in_tree = false;
+
+      for (op = 0; op < OP_CNT; op++)
+        {
+          struct value *v = &values[random_ulong () % ELEM_CNT];
+          uint64_t start, end;
+
+          if (v->in_tree)
+            interval_remove (&tree, &v->elem);
+          else
+            {
+              random_interval (ranges[r], &start, &end);
+              interval_insert (&tree, &v->elem, start, end);
+            }
+          v->in_tree = !v->in_tree;
+
+          verify_tree (&tree);
+          for (i = 0; i < QUERY_CNT; i++)
+            {
+              random_interval (ranges[r] + 8, &start, &end);
+              verify_query (&tree, start, end);
+            }
+        }
+
+      /* Empty the tree again. */
+      for (i = 0; i < ELEM_CNT; i++)
+        if (values[i].in_tree)
+          {
+            interval_remove (&tree, &values[i].elem);
+            values[i].in_tree = false;
+            verify_tree (&tree);
+          }
+      ASSERT (interval_empty (&tree));
+      ASSERT (tree.root == NULL);
+    }
+  printf ("interval: PASS\n");
+}
+
+/* Stores a random interval within [0, RANGE + 8) in *START and
+   *END.  About one in eight is empty. */
+static void
+random_interval (uint64_t range, uint64_t *start, uint64_t *end)
+{
+  *start = random_ulong () % range;
+  *end = *start + (random_ulong () % 8 == 0 ? 0 : random_ulong () % 8 + 1);
+}
+
+/* Checks the subtree rooted at E, whose parent should be PARENT:
+   its links, its order, that no red node has a red child, and each
+   node's MAX_END.  Returns the subtree's black height. */
+static int
+verify_subtree (const struct interval_elem *e,
+                const struct interval_elem *parent)
+{
+  uint64_t max_end;
+  int left_height, right_height;
+
+  if (e == NULL)
+    return 1;
+
+  ASSERT (e->parent == parent);
+  ASSERT (!e->red || parent == NULL || !parent->red);
+  ASSERT (e->left == NULL || e->left->start <= e->start);
+  ASSERT (e->right == NULL || e->right->start >= e->start);
+
+  left_height = verify_subtree (e->left, e);
+  right_height = verify_subtree (e->right, e);
+  ASSERT (left_height == right_height);
+
+  max_end = e->end;
+  if (e->left != NULL && e->left->max_end > max_end)
+    max_end = e->left->max_end;
+  if (e->right != NULL && e->right->max_end > max_end)
+    max_end = e->right->max_end;
+  ASSERT (e->max_end == max_end);
+
+  return left_height + !e->red;
+}
+
+/* Checks the invariants of TREE and its element count. */
+static void
+verify_tree (struct interval_tree *tree)
+{
+  size_t cnt = 0;
+  int i;
+
+  ASSERT (tree->root == NULL || !tree->root->red);
+  verify_subtree (tree->root, NULL);
+
+  for (i = 0; i < ELEM_CNT; i++)
+    cnt += values[i].in_tree;
+  ASSERT (interval_size (tree) == cnt);
+  ASSERT (interval_empty (tree) == (cnt == 0));
+}
+
+/* Checks that interval_first() and interval_next() visit exactly
+   the intervals in TREE that overlap [START, END), in order of
+   their starts, each once, as a linear scan finds them. */
+static void
+verify_query (struct interval_tree *tree, uint64_t start, uint64_t end)
+{
+  static bool seen[ELEM_CNT];
+  struct interval_elem *e;
+  uint64_t prev_start = 0;
+  size_t found = 0, expected = 0;
+  int i;
+
+  for (i = 0; i < ELEM_CNT; i++)
+    seen[i] = false;
+
+  for (e = interval_first (tree, start, end); e != NULL;
+       e = interval_next (e, start, end))
+    {
+      struct value *v = interval_entry (e, struct value, elem);
+      int idx = v - values;
+
+      ASSERT (idx >= 0 && idx < ELEM_CNT);
+      ASSERT (v->in_tree && !seen[idx]);
+      ASSERT (e->start < end && e->end > start);
+      ASSERT (e->start >= prev_start);
+      seen[idx] = true;
+      prev_start = e->start;
+      found++;
+    }
+
+  for (i = 0; i < ELEM_CNT; i++)
+    if (values[i].in_tree && values[i].elem.start < end
+        && values[i].elem.end > start)
+      {
+        ASSERT (seen[i]);
+        expected++;
+      }
+  ASSERT (found == expected);
+}
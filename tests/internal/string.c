@@ -0,0 +1,179 @@
+/* Test program and microbenchmark for lib/string.c.
+
+   Checks memcpy(), memset(), memcmp() and strlen() against
+   byte-at-a-time references at every small alignment and a range
+   of lengths, then times page-sized copies, fills and compares,
+   which is what the kernel mostly does with these functions.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/test.h"
+
+/* Number of page-sized operations timed per function. */
+#define ITER_CNT 20000
+
+static void verify (uint8_t *a, uint8_t *b);
+static void benchmark (uint8_t *a, uint8_t *b);
+
+/* Test and time the string block functions. */
+void
+test (void)
+{
+  uint8_t *a = palloc_get_page (PAL_ASSERT);
+  uint8_t *b = palloc_get_page (PAL_ASSERT);
+
+  verify (a, b);
+  benchmark (a, b);
+  palloc_free_page (a);
+  palloc_free_page (b);
+  printf ("string: PASS\n");
+}
+
+/* Fills the SIZE bytes at P with random data. */
+static void
+randomize (uint8_t *p, size_t size)
+{
+  random_bytes (p, size);
+}
+
+/* Byte-at-a-time references: the original implementations. */
+static void
+ref_memcpy (uint8_t *dst, const uint8_t *src, size_t size)
+{
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+ref_memset (uint8_t *dst, int value, size_t size)
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+static int
+ref_memcmp (const uint8_t *a, const uint8_t *b, size_t size)
+{
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static size_t
+ref_strlen (const char *s)
+{
+  const char *p;
+
+  for (p = s; *p != '\0'; p++)
+    continue;
+  return p - s;
+}
+
+/* Checks each function at source and destination offsets 0...7
+   and lengths 0...200 against the reference, including that
+   nothing outside the destination range is touched. */
+static void
+verify (uint8_t *a, uint8_t *b)
+{
+  size_t dofs, sofs, len, i;
+
+  for (dofs = 0; dofs < 8; dofs++)
+    for (sofs = 0; sofs < 8; sofs++)
+      for (len = 0; len <= 200; len += len < 40 ? 1 : 7)
+        {
+          uint8_t expect[256];
+
+          randomize (a, 256);
+          randomize (b, 256);
+          memcpy (expect, b, 256);
+
+          ref_memcpy (expect + dofs, a + sofs, len);
+          memcpy (b + dofs, a + sofs, len);
+          ASSERT (ref_memcmp (b, expect, 256) == 0);
+
+          ref_memset (expect + dofs, 0xa5, len);
+          memset (b + dofs, 0xa5, len);
+          ASSERT (ref_memcmp (b, expect, 256) == 0);
+
+          /* Vary one byte anywhere in the range and check the
+             sign of the comparison. */
+          memcpy (b + dofs, a + sofs, len);
+          ASSERT (memcmp (b + dofs, a + sofs, len) == 0);
+          if (len > 0)
+            {
+              i = random_ulong () % len;
+              b[dofs + i] ^= 1 << (random_ulong () % 8);
+              ASSERT (memcmp (b + dofs, a + sofs, len)
+                      == ref_memcmp (b + dofs, a + sofs, len));
+            }
+
+          for (i = 0; i < len; i++)
+            a[sofs + i] = random_ulong () % 255 + 1;
+          a[sofs + len] = '\0';
+          ASSERT (strlen ((char *) a + sofs)
+                  == ref_strlen ((char *) a + sofs));
+        }
+}
+
+/* Times ITER_CNT page copies, fills and compares with both the
+   library and the reference, and prints the ticks each took. */
+static void
+benchmark (uint8_t *a, uint8_t *b)
+{
+  int64_t start, fast, slow;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    memcpy (a, b, PGSIZE);
+  fast = timer_elapsed (start);
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    ref_memcpy (a, b, PGSIZE);
+  slow = timer_elapsed (start);
+  printf ("memcpy: %lld ticks, byte loop %lld ticks\n", fast, slow);
+
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    memset (a, i, PGSIZE);
+  fast = timer_elapsed (start);
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    ref_memset (a, i, PGSIZE);
+  slow = timer_elapsed (start);
+  printf ("memset: %lld ticks, byte loop %lld ticks\n", fast, slow);
+
+  memcpy (b, a, PGSIZE);
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    memcmp (a, b, PGSIZE);
+  fast = timer_elapsed (start);
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    ref_memcmp (a, b, PGSIZE);
+  slow = timer_elapsed (start);
+  printf ("memcmp: %lld ticks, byte loop %lld ticks\n", fast, slow);
+
+  memset (a, 'x', PGSIZE - 1);
+  a[PGSIZE - 1] = '\0';
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    strlen ((char *) a);
+  fast = timer_elapsed (start);
+  start = timer_ticks ();
+  for (i = 0; i < ITER_CNT; i++)
+    ref_strlen ((char *) a);
+  slow = timer_elapsed (start);
+  printf ("strlen: %lld ticks, byte loop %lld ticks\n", fast, slow);
+}
@@ -0,0 +1,68 @@
+/* Gives each kind of advice with madvise() and checks that
+   MADV_DONTNEED discards anonymous memory, which then reads as
+   zeros, but keeps the contents of an initialized data page, which
+   zeros would not bring back.  Also checks that bad ranges and
+   unknown advice are rejected. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ACTUAL ((char *) 0x10000000)
+
+static char data[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)))
+  = "initialized data";
+static char bss[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* Returns true if the SIZE bytes at P are all zero. */
+static bool
+is_zero (const char *p, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != 0)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  char *anon = ACTUAL;
+  int advice;
+
+  CHECK (mmap (anon, 2 * PAGE_SIZE, true, -1, 0) == anon,
+         "mmap anonymous memory");
+  memset (anon, 'a', 2 * PAGE_SIZE);
+  for (advice = MADV_NORMAL; advice <= MADV_WILLNEED; advice++)
+    CHECK (madvise (anon, 2 * PAGE_SIZE, advice) == 0,
+           "madvise with advice %d", advice);
+  CHECK (anon[0] == 'a' && anon[2 * PAGE_SIZE - 1] == 'a',
+         "advice keeps the contents");
+
+  CHECK (madvise (anon, PAGE_SIZE, MADV_DONTNEED) == 0,
+         "discard the first page");
+  CHECK (is_zero (anon, PAGE_SIZE), "discarded page reads as zeros");
+  CHECK (anon[PAGE_SIZE] == 'a', "second page is untouched");
+
+  memset (bss, 'b', PAGE_SIZE);
+  CHECK (madvise (bss, PAGE_SIZE, MADV_DONTNEED) == 0,
+         "discard a bss page");
+  CHECK (is_zero (bss, PAGE_SIZE), "bss page reads as zeros");
+
+  data[0] = 'I';
+  CHECK (madvise (data, PAGE_SIZE, MADV_DONTNEED) == 0,
+         "madvise a data page");
+  CHECK (!strcmp (data, "Initialized data"), "data page keeps its contents");
+
+  CHECK (madvise (anon + 1, PAGE_SIZE, MADV_NORMAL) == -1,
+         "reject a misaligned address");
+  CHECK (madvise (anon, 3 * PAGE_SIZE, MADV_NORMAL) == -1,
+         "reject a range not fully mapped");
+  CHECK (madvise (anon, PAGE_SIZE, MADV_DONTNEED + 1) == -1,
+         "reject unknown advice");
+  munmap (anon);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(madvise) begin
+(madvise) mmap anonymous memory
+(madvise) madvise with advice 0
+(madvise) madvise with advice 1
+(madvise) madvise with advice 2
+(madvise) madvise with advice 3
+(madvise) advice keeps the contents
+(madvise) discard the first page
+(madvise) discarded page reads as zeros
+(madvise) second page is untouched
+(madvise) discard a bss page
+(madvise) bss page reads as zeros
+(madvise) madvise a data page
+(madvise) data page keeps its contents
+(madvise) reject a misaligned address
+(madvise) reject a range not fully mapped
+(madvise) reject unknown advice
+(madvise) end
+EOF
+pass;
@@ -0,0 +1,156 @@
+/* Exercises the user-space malloc() over anonymous mmap(): blocks
+   of every small size class, reuse of freed small blocks, calloc()
+   on reused memory, the merging and reuse of freed large blocks'
+   address space, and realloc() growing a block from small to large.
+   Finally maps anonymous memory directly and unmaps it. */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define ACTUAL ((char *) 0x10000000)
+
+/* Small size classes, from 16 bytes to 2 kB. */
+#define CLASS_CNT 8
+#define BLOCK_CNT 64
+
+static char *blocks[CLASS_CNT][BLOCK_CNT];
+
+/* Returns true if the SIZE bytes at P all equal BYTE. */
+static bool
+all_equal (const char *p, size_t size, char byte)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != byte)
+      return false;
+  return true;
+}
+
+static void
+small_blocks (void)
+{
+  size_t class, i;
+  char *p;
+
+  for (class = 0; class < CLASS_CNT; class++)
+    for (i = 0; i < BLOCK_CNT; i++)
+      {
+        size_t size = 16 << class;
+
+        p = blocks[class][i] = malloc (size);
+        if (p == NULL || (uintptr_t) p % 16 != 0)
+          fail ("malloc (%zu) returned %p", size, p);
+        memset (p, class * BLOCK_CNT + i, size);
+      }
+  msg ("allocated blocks of every size class");
+
+  for (class = 0; class < CLASS_CNT; class++)
+    for (i = 0; i < BLOCK_CNT; i++)
+      if (!all_equal (blocks[class][i], 16 << class,
+                      (char) (class * BLOCK_CNT + i)))
+        fail ("block %zu of %zu bytes was overwritten", i,
+              (size_t) 16 << class);
+  msg ("blocks hold their contents");
+
+  for (class = 0; class < CLASS_CNT; class++)
+    {
+      free (blocks[class][1]);
+      p = malloc (16 << class);
+      if (p != blocks[class][1])
+        fail ("freed block of %zu bytes not reused", (size_t) 16 << class);
+    }
+  msg ("freed blocks are reused");
+
+  /* 1000 bytes come from the 1 kB class, whose last freed block is
+     full of nonzero bytes. */
+  free (blocks[6][2]);
+  p = calloc (100, 10);
+  CHECK (p == blocks[6][2] && all_equal (p, 1000, 0),
+         "calloc zeroes reused memory");
+
+  for (class = 0; class < CLASS_CNT; class++)
+    for (i = 0; i < BLOCK_CNT; i++)
+      free (blocks[class][i]);
+}
+
+static void
+large_blocks (void)
+{
+  char *a, *b, *c, *d;
+
+  a = malloc (3 * PAGE_SIZE);
+  b = malloc (5 * PAGE_SIZE);
+  c = malloc (2 * PAGE_SIZE);
+  CHECK (a != NULL && b != NULL && c != NULL, "allocate large blocks");
+  memset (a, 'a', 3 * PAGE_SIZE);
+  memset (b, 'b', 5 * PAGE_SIZE);
+  memset (c, 'c', 2 * PAGE_SIZE);
+
+  /* A and B lie next to each other, so freeing both leaves one hole
+     that fits a block larger than either. */
+  free (a);
+  free (b);
+  d = malloc (8 * PAGE_SIZE);
+  CHECK (d == a, "freed neighbors' space reused for a larger block");
+  CHECK (all_equal (d, 8 * PAGE_SIZE, 0), "reused space reads as zeros");
+  memset (d, 'd', 8 * PAGE_SIZE);
+  CHECK (all_equal (c, 2 * PAGE_SIZE, 'c'), "other block is intact");
+  free (c);
+  free (d);
+}
+
+static void
+realloc_growth (void)
+{
+  static const size_t sizes[] = {100, 1000, 3 * PAGE_SIZE, 13 * PAGE_SIZE};
+  char *p = NULL;
+  uintptr_t addr;
+  size_t old = 0, i;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      p = realloc (p, sizes[i]);
+      if (p == NULL)
+        fail ("realloc to %zu bytes failed", sizes[i]);
+      if (!all_equal (p, old, 'r'))
+        fail ("realloc to %zu bytes lost the contents", sizes[i]);
+      memset (p + old, 'r', sizes[i] - old);
+      old = sizes[i];
+    }
+  msg ("realloc keeps contents while growing");
+  addr = (uintptr_t) p;
+  p = realloc (p, 10);
+  CHECK ((uintptr_t) p == addr, "realloc shrinks in place");
+  CHECK (realloc (p, 0) == NULL, "realloc to 0 bytes frees");
+}
+
+static void
+anon_mmap (void)
+{
+  char *anon = ACTUAL;
+
+  CHECK (mmap (anon, 2 * PAGE_SIZE, true, -1, 0) == anon,
+         "mmap anonymous memory");
+  CHECK (all_equal (anon, 2 * PAGE_SIZE, 0), "anonymous memory is zeros");
+  memset (anon, 'm', 2 * PAGE_SIZE);
+  munmap (anon);
+  CHECK (mmap (anon, PAGE_SIZE, true, -1, 0) == anon,
+         "mmap again where it was unmapped");
+  CHECK (all_equal (anon, PAGE_SIZE, 0), "new mapping is zeros");
+  munmap (anon);
+}
+
+void
+test_main (void)
+{
+  small_blocks ();
+  large_blocks ();
+  realloc_growth ();
+  anon_mmap ();
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(malloc) begin
+(malloc) allocated blocks of every size class
+(malloc) blocks hold their contents
+(malloc) freed blocks are reused
+(malloc) calloc zeroes reused memory
+(malloc) allocate large blocks
+(malloc) freed neighbors' space reused for a larger block
+(malloc) reused space reads as zeros
+(malloc) other block is intact
+(malloc) realloc keeps contents while growing
+(malloc) realloc shrinks in place
+(malloc) realloc to 0 bytes frees
+(malloc) mmap anonymous memory
+(malloc) anonymous memory is zeros
+(malloc) mmap again where it was unmapped
+(malloc) new mapping is zeros
+(malloc) end
+EOF
+pass;
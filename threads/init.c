@@ -17,6 +17,7 @@
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memstat.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
@@ -31,6 +32,7 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -107,6 +109,10 @@ main (void) {
 	serial_init_queue ();
 	timer_calibrate ();
 
+#ifdef VM
+	/* The file system's page cache needs the frame table. */
+	vm_frame_init ();
+#endif
 #ifdef FILESYS
 	/* Initialize file system. */
 	disk_init ();
@@ -156,7 +162,9 @@ paging_init (uint64_t mem_end) {
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
-		perm = PTE_P | PTE_W;
+		/* Kernel mappings are the same in every address space, so
+		 * mark them global to keep them in the TLB across CR3 loads. */
+		perm = PTE_P | PTE_W | PTE_G;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
@@ -166,6 +174,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	mmu_init ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -222,11 +231,17 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-memstat-sites"))
+			memstat_sites = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-rss"))
+			rss_limit = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -253,6 +268,12 @@ run_task (char **argv) {
 	printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints memory usage statistics. */
+static void
+run_memstat (char **argv UNUSED) {
+	memstat_print_stats ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -267,6 +288,7 @@ run_actions (char **argv) {
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+		{"memstat", 1, run_memstat},
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
@@ -313,6 +335,7 @@ usage (void) {
 #else
 			"  run TEST           Run TEST.\n"
 #endif
+			"  memstat            Print memory usage statistics.\n"
 #ifdef FILESYS
 			"  ls                 List files in the root directory.\n"
 			"  cat FILE           Print FILE to the console.\n"
@@ -327,8 +350,12 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -memstat-sites     Count memory allocations by call site.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -rss=COUNT         Limit each process to COUNT resident pages.\n"
 #endif
 			);
 	power_off ();
@@ -355,6 +382,7 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	memstat_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
@@ -363,4 +391,7 @@ print_stats (void) {
 #ifdef USERPROG
 	exception_print_stats ();
 #endif
+#ifdef VM
+	zswap_print_stats ();
+#endif
 }
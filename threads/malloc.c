@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/memstat.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -40,6 +41,7 @@ struct desc {
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
 	struct lock lock;           /* Lock. */
+	struct memstat stat;        /* Allocation counters. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -61,6 +63,10 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Counters for blocks too big for any descriptor. */
+static struct memstat big_stat;
+
+static void *malloc_at (size_t, void *site);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
@@ -83,6 +89,13 @@ malloc_init (void) {
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
+	return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Does the work for malloc(), calloc() and realloc(), crediting
+   the allocation to call site SITE. */
+static void *
+malloc_at (size_t size, void *site) {
 	struct desc *d;
 	struct block *b;
 	struct arena *a;
@@ -101,8 +114,11 @@ malloc (size_t size) {
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
+		if (a == NULL) {
+			memstat_fail (&big_stat);
 			return NULL;
+		}
+		memstat_alloc (&big_stat, PGSIZE * page_cnt, site);
 
 		/* Initialize the arena to indicate a big block of PAGE_CNT
 		   pages, and return it. */
@@ -121,6 +137,7 @@ malloc (size_t size) {
 		/* Allocate a page. */
 		a = palloc_get_page (0);
 		if (a == NULL) {
+			memstat_fail (&d->stat);
 			lock_release (&d->lock);
 			return NULL;
 		}
@@ -139,6 +156,7 @@ malloc (size_t size) {
 	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
 	a = block_to_arena (b);
 	a->free_cnt--;
+	memstat_alloc (&d->stat, d->block_size, site);
 	lock_release (&d->lock);
 	return b;
 }
@@ -156,7 +174,7 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = malloc_at (size, __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
@@ -185,7 +203,8 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = malloc_at (new_size,
+				__builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
 			size_t old_size = block_size (old_block);
 			size_t min_size = new_size < old_size ? new_size : old_size;
@@ -214,6 +233,7 @@ free (void *p) {
 #endif
 
 			lock_acquire (&d->lock);
+			memstat_free (&d->stat, d->block_size);
 
 			/* Add block to free list. */
 			list_push_front (&d->free_list, &b->free_elem);
@@ -233,12 +253,28 @@ free (void *p) {
 			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
+			memstat_free (&big_stat, PGSIZE * a->free_cnt);
 			palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
 	}
 }
 
+/* Prints malloc() statistics, one line per size class. */
+void
+malloc_print_stats (void) {
+	size_t i;
+
+	printf ("Malloc:\n");
+	for (i = 0; i < desc_cnt; i++) {
+		char name[16];
+
+		snprintf (name, sizeof name, "%zu B", descs[i].block_size);
+		memstat_print (name, &descs[i].stat);
+	}
+	memstat_print ("big", &big_stat);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
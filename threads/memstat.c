@@ -0,0 +1,134 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+
+/* Memory usage accounting.
+
+   The page allocator and malloc() keep a struct memstat for each
+   pool and each size class, and report every allocation, free
+   and failure here.  On request (-memstat-sites) we also count
+   allocations by call site, that is, by the return address of
+   the palloc or malloc entry point that was called.  Feed the
+   printed addresses to the `backtrace' utility to turn them into
+   function names. */
+
+/* -memstat-sites: Keep a histogram of allocation call sites? */
+bool memstat_sites;
+
+/* One allocation call site. */
+struct site {
+	void *pc;                   /* Return address of the caller. */
+	uint64_t alloc_cnt;         /* Allocations from here. */
+	uint64_t bytes;             /* Total bytes allocated from here. */
+};
+
+/* Open-addressed hash table of call sites.  Sites that do not
+   fit are counted in OTHER_SITES. */
+#define SITE_CNT 128
+static struct site sites[SITE_CNT];
+static struct site other_sites;
+
+/* Number of sites memstat_print_sites() prints. */
+#define TOP_SITES 16
+
+static void count_site (void *pc, size_t bytes);
+
+/* Records an allocation of BYTES bytes against M, made from SITE. */
+void
+memstat_alloc (struct memstat *m, size_t bytes, void *site) {
+	size_t in_use;
+
+	__atomic_fetch_add (&m->alloc_cnt, 1, __ATOMIC_RELAXED);
+	in_use = __atomic_add_fetch (&m->in_use, bytes, __ATOMIC_RELAXED);
+	if (in_use > m->peak)
+		m->peak = in_use;
+	if (memstat_sites)
+		count_site (site, bytes);
+}
+
+/* Records freeing BYTES bytes against M. */
+void
+memstat_free (struct memstat *m, size_t bytes) {
+	__atomic_fetch_add (&m->free_cnt, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub (&m->in_use, bytes, __ATOMIC_RELAXED);
+}
+
+/* Records a failed allocation against M. */
+void
+memstat_fail (struct memstat *m) {
+	__atomic_fetch_add (&m->fail_cnt, 1, __ATOMIC_RELAXED);
+}
+
+/* Prints one line of counters for M, labeled NAME. */
+void
+memstat_print (const char *name, const struct memstat *m) {
+	printf ("  %-10s %8"PRIu64" allocs %8"PRIu64" frees %4"PRIu64" fails"
+			" %8zu kB used %8zu kB peak\n",
+			name, m->alloc_cnt, m->free_cnt, m->fail_cnt,
+			m->in_use / 1024, m->peak / 1024);
+}
+
+/* Prints the call sites that allocated the most bytes. */
+void
+memstat_print_sites (void) {
+	bool printed[SITE_CNT] = { false };
+	int i, j;
+
+	if (!memstat_sites) {
+		printf ("Memstat: call sites not tracked (use -memstat-sites)\n");
+		return;
+	}
+
+	printf ("Memstat: top call sites by bytes allocated\n");
+	for (i = 0; i < TOP_SITES; i++) {
+		int best = -1;
+
+		for (j = 0; j < SITE_CNT; j++)
+			if (sites[j].pc != NULL && !printed[j]
+					&& (best < 0 || sites[j].bytes > sites[best].bytes))
+				best = j;
+		if (best < 0)
+			break;
+		printed[best] = true;
+		printf ("  %p %8"PRIu64" allocs %10"PRIu64" bytes\n",
+				sites[best].pc, sites[best].alloc_cnt, sites[best].bytes);
+	}
+	if (other_sites.alloc_cnt > 0)
+		printf ("  (others)           %8"PRIu64" allocs %10"PRIu64" bytes\n",
+				other_sites.alloc_cnt, other_sites.bytes);
+}
+
+/* Prints all memory statistics. */
+void
+memstat_print_stats (void) {
+	palloc_print_stats ();
+	malloc_print_stats ();
+	memstat_print_sites ();
+}
+
+/* Adds an allocation of BYTES bytes to the histogram entry for
+   PC.  Disables interrupts instead of locking, so that it is safe
+   in any context. */
+static void
+count_site (void *pc, size_t bytes) {
+	size_t h = ((uintptr_t) pc >> 2) * 0x9e3779b97f4a7c15ULL >> 57;
+	enum intr_level old_level = intr_disable ();
+	struct site *s = &other_sites;
+	size_t i;
+
+	for (i = 0; i < SITE_CNT; i++) {
+		struct site *probe = &sites[(h + i) % SITE_CNT];
+		if (probe->pc == pc || probe->pc == NULL) {
+			probe->pc = pc;
+			s = probe;
+			break;
+		}
+	}
+	s->alloc_cnt++;
+	s->bytes += bytes;
+	intr_set_level (old_level);
+}
@@ -8,6 +8,146 @@
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Control register and CPUID feature bits used below.
+ * See [IA32-v3a] 4.10.1 "Process-Context Identifiers". */
+#define CR0_WP (1 << 16)                /* Write-protect in kernel mode. */
+#define CR4_PGE (1 << 7)                /* Global pages enable. */
+#define CR4_PCIDE (1 << 17)             /* PCID enable. */
+#define CPUID_1_EDX_PGE (1 << 13)       /* Global pages supported. */
+#define CPUID_1_ECX_PCID (1 << 17)      /* PCIDs supported. */
+#define CR3_NOFLUSH (1ULL << 63)        /* Keep PCID's TLB entries on load. */
+
+/* Process-context identifiers.
+ *
+ * When the CPU supports them, every user page map level 4 is
+ * tagged with a PCID, so that loading it into CR3 keeps the TLB
+ * entries of the other address spaces around.  PCID 0 belongs to
+ * base_pml4.  A pml4 hashes onto one of the other PCID_CNT - 1
+ * identifiers, and pcid_owner[] records which pml4 the TLB
+ * entries tagged with that identifier belong to.  A pml4 that
+ * finds someone else there takes the identifier over and flushes
+ * its stale entries while loading CR3.
+ *
+ * Kernel mappings are global (PTE_G), so they survive every CR3
+ * load, with or without PCIDs. */
+#define PCID_CNT 256
+static bool pcid_enabled;
+static uint64_t *pcid_owner[PCID_CNT];
+
+static unsigned
+pcid_of (uint64_t *pml4) {
+	return 1 + (vtop (pml4) >> PGBITS) % (PCID_CNT - 1);
+}
+
+/* Makes the next activation of PML4 flush whatever the TLB still
+ * holds under its PCID.
+ * Racing with pml4_activate() is harmless: at worst some other
+ * pml4 loses the identifier and pays for one extra flush. */
+static void
+pcid_forget (uint64_t *pml4) {
+	unsigned pcid = pcid_of (pml4);
+	if (pcid_owner[pcid] == pml4)
+		pcid_owner[pcid] = NULL;
+}
+
+/* Drops the TLB entry for user page VA of PML4.  If PML4 is not
+ * the one loaded into CR3 its entries can only live on under its
+ * PCID, so those are invalidated on its next activation. */
+static void
+tlb_invalidate (uint64_t *pml4, const void *va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg ((uint64_t) va);
+	else if (pcid_enabled)
+		pcid_forget (pml4);
+}
+
+/* Drops all of PML4's TLB entries, as tlb_invalidate() does one. */
+static void
+tlb_flush (uint64_t *pml4) {
+	/* Reloading CR3 without CR3_NOFLUSH drops the non-global
+	 * entries tagged with the PCID loaded, which are all of them
+	 * when PCIDs are off. */
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		lcr3 (rcr3 ());
+	else if (pcid_enabled)
+		pcid_forget (pml4);
+}
+
+/* TLB gathering.
+ *
+ * Operations on many pages at once, such as unmapping a region or
+ * tearing down an address space, clear the PTEs with
+ * tlb_gather_clear_page() and leave the TLB alone until
+ * tlb_gather_finish(), which invalidates the pages gathered one by
+ * one, or, once there are more than TLB_GATHER_MAX of them, flushes
+ * the whole address space, which is cheaper than that many invlpgs
+ * and the TLB misses are mostly for the pages being unmapped anyway.
+ * Until then, the TLB may still hold the pages gathered, so their
+ * frames must not be reused. */
+
+/* Starts gathering invalidations for PML4 into G. */
+void
+tlb_gather_init (struct tlb_gather *g, uint64_t *pml4) {
+	g->pml4 = pml4;
+	g->cnt = 0;
+}
+
+/* Marks user virtual page UPAGE of G's pml4 "not present", like
+ * pml4_clear_page(), gathering its TLB invalidation into G. */
+void
+tlb_gather_clear_page (struct tlb_gather *g, void *upage) {
+	uint64_t *pte;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pte = pml4e_walk (g->pml4, (uint64_t) upage, false);
+	if (pte != NULL && (*pte & PTE_P) != 0) {
+		*pte &= ~PTE_P;
+		if (g->cnt < TLB_GATHER_MAX)
+			g->va[g->cnt] = upage;
+		if (g->cnt <= TLB_GATHER_MAX)
+			g->cnt++;
+	}
+}
+
+/* Does the invalidations gathered in G, and empties it. */
+void
+tlb_gather_finish (struct tlb_gather *g) {
+	size_t i;
+
+	if (g->cnt > TLB_GATHER_MAX)
+		tlb_flush (g->pml4);
+	else
+		for (i = 0; i < g->cnt; i++)
+			tlb_invalidate (g->pml4, g->va[i]);
+	g->cnt = 0;
+}
+
+/* Turns on global pages and, if the CPU has them, PCIDs.
+ * Must be called with base_pml4 loaded, since CR4.PCIDE can only
+ * be set while the current PCID is 0.
+ *
+ * Also makes read-only user pages read-only to the kernel too, so
+ * that a kernel write to a copy-on-write page faults instead of
+ * going to the shared frame. */
+void
+mmu_init (void) {
+	uint32_t regs[4];
+	uint64_t cr4 = rcr4 ();
+
+	lcr0 (rcr0 () | CR0_WP);
+
+	cpuid (1, regs);
+	if (regs[3] & CPUID_1_EDX_PGE)
+		cr4 |= CR4_PGE;
+	if (regs[2] & CPUID_1_ECX_PCID) {
+		cr4 |= CR4_PCIDE;
+		pcid_enabled = true;
+	}
+	lcr4 (cr4);
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -192,6 +332,9 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	if (pcid_enabled)
+		pcid_forget (pml4);
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -200,10 +343,33 @@ pml4_destroy (uint64_t *pml4) {
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  Nothing is done if PD is already loaded, since every
+ * change to a loaded pml4 invalidates the affected TLB entries. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t cr3;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	cr3 = vtop (pml4);
+	if (PTE_ADDR (rcr3 ()) == cr3)
+		return;
+
+	if (pcid_enabled) {
+		/* base_pml4 holds only global mappings, so PCID 0 never
+		 * has anything to flush. */
+		if (pml4 == base_pml4)
+			cr3 |= CR3_NOFLUSH;
+		else {
+			unsigned pcid = pcid_of (pml4);
+			if (pcid_owner[pcid] == pml4)
+				cr3 |= CR3_NOFLUSH;
+			else
+				pcid_owner[pcid] = pml4;
+			cr3 |= pcid;
+		}
+	}
+	lcr3 (cr3);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -238,11 +404,51 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			tlb_invalidate (pml4, upage);
+	}
 	return pte != NULL;
 }
 
+/* Maps the CNT user virtual pages from UPAGE to the frames at
+ * KPAGES[], like CNT calls to pml4_set_page(), but walking the page
+ * table only once for each page table page the range covers, since
+ * the entries within one are consecutive.  Returns true if
+ * successful, false if memory allocation failed, in which case some
+ * of the pages may be mapped. */
+bool
+pml4_set_pages (uint64_t *pml4, void *upage, void *const kpages[],
+		size_t cnt, bool rw) {
+	uint64_t *pte = NULL;
+	size_t i;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (pml4 != base_pml4);
+
+	for (i = 0; i < cnt; i++) {
+		uint8_t *va = (uint8_t *) upage + i * PGSIZE;
+		bool was_present;
+
+		ASSERT (pg_ofs (kpages[i]) == 0);
+		ASSERT (is_user_vaddr (va));
+
+		if (pte == NULL || PTX (va) == 0) {
+			pte = pml4e_walk (pml4, (uint64_t) va, 1);
+			if (pte == NULL)
+				return false;
+		} else
+			pte++;
+		was_present = (*pte & PTE_P) != 0;
+		*pte = vtop (kpages[i]) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			tlb_invalidate (pml4, va);
+	}
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -257,8 +463,7 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate (pml4, upage);
 	}
 }
 
@@ -283,8 +488,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
 
@@ -309,7 +513,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
 	}
 }
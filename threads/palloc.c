@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memstat.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -22,26 +24,78 @@
    that the kernel needs to have memory for its own operations
    even if user processes are swapping like mad.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   The split between the pools is not fixed.  RAM is cut into
+   chunks of CHUNK_PAGES pages, each owned by the kernel pool, the
+   user pool, or a shared reserve.  At boot each pool gets a
+   quarter of RAM and the rest goes to the reserve.  A pool that
+   runs out takes a chunk from the reserve, or failing that a
+   completely free chunk from the other pool, and gives a chunk
+   back to the reserve when it becomes completely free while the
+   pool has plenty of free pages anyway.  An allocation therefore
+   fails only when memory as a whole is short, which is when
+   reclaim should kick in; see palloc_below_wmark(). */
+
+/* Pages per chunk: 1 MB. */
+#define CHUNK_PAGES 256
+
+/* A pool returns a free chunk to the reserve only if it still has
+   this many free pages afterward. */
+#define TRIM_PAGES (2 * CHUNK_PAGES)
+
+/* Free pages the kernel pool keeps for itself even when the user
+   pool wants them, so that the kernel can still make progress
+   while user processes are swapping like mad. */
+#define KERNEL_MIN_FREE 64
+
+/* Owner of a chunk. */
+enum chunk_owner {
+	CHUNK_NONE,                     /* No usable pages. */
+	CHUNK_RESERVE,                  /* Shared reserve. */
+	CHUNK_KERNEL,                   /* Kernel pool. */
+	CHUNK_USER                      /* User pool. */
+};
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
-	uint8_t *base;                  /* Base of pool. */
+	size_t owned_cnt;               /* Usable pages in owned chunks. */
+	size_t free_cnt;                /* Free pages in owned chunks. */
+	size_t min_free;                /* Never lend below this many. */
+	enum chunk_owner owner;         /* Tag in chunk_owner[]. */
+	struct memstat stat;            /* Allocation counters. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-/* Maximum number of pages to put in user pool. */
+/* All managed memory starts here.  Both pools' bitmaps cover
+   every page from BASE up to the end of RAM; a pool may only
+   hand out pages in chunks it owns. */
+static uint8_t *base;
+static struct bitmap *usable_map;       /* Usable RAM pages. */
+static size_t chunk_cnt;
+static uint8_t *chunk_owner;            /* Owner of each chunk. */
+static uint16_t *chunk_usable;          /* Usable pages per chunk. */
+
+/* Usable pages in chunks owned by neither pool.  Protected by
+   balance_lock, which also serializes every chunk transfer. */
+static size_t reserve_cnt;
+static struct lock balance_lock;
+
+/* Reclaim watermarks, in free pages. */
+static size_t wmark[2];
+
+/* Maximum number of pages in use in the user pool. */
 size_t user_page_limit = SIZE_MAX;
-static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
-static bool page_from_pool (const struct pool *, void *page);
+static void *get_pages (enum palloc_flags, size_t page_cnt, void *site);
+static struct pool *pool_of (const void *page);
+static bool chunk_is_free (size_t chunk, struct pool *);
+static void chunk_take (size_t chunk, struct pool *);
+static bool pool_grow (struct pool *, size_t page_cnt);
+static void pool_trim (struct pool *, size_t chunk);
+static void chunk_give (size_t chunk, enum chunk_owner);
 
 /* multiboot info */
 struct multiboot_info {
@@ -113,125 +167,84 @@ resolve_area_info (struct area *base_mem, struct area *ext_mem) {
 	}
 }
 
-/*
- * Populate the pool.
- * All the pages are manged by this allocator, even include code page.
- * Basically, give half of memory to kernel, half to user.
- * We push base_mem portion to the kernel as much as possible.
- */
+/* Sets up the bookkeeping for every page of RAM right after the
+   kernel image, marks the usable pages, and deals out the chunks.
+   We push the low chunks, including base_mem, to the kernel. */
 static void
 populate_pools (struct area *base_mem, struct area *ext_mem) {
 	extern char _end;
-	void *free_start = pg_round_up (&_end);
-
-	uint64_t total_pages = (base_mem->size + ext_mem->size) / PGSIZE;
-	uint64_t user_pages = total_pages / 2 > user_page_limit ?
-		user_page_limit : total_pages / 2;
-	uint64_t kern_pages = total_pages - user_pages;
-
-	// Parse E820 map to claim the memory region for each pool.
-	enum { KERN_START, KERN, USER_START, USER } state = KERN_START;
-	uint64_t rem = kern_pages;
-	uint64_t region_start = 0, end = 0, start, size, size_in_pg;
-
+	uint8_t *buf = pg_round_up (&_end);
 	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
 	struct e820_entry *entries = ptov (mb_info->mmap_base);
-
+	uint64_t mem_end = ext_mem->size ? ext_mem->end : base_mem->end;
+	uint64_t usable_bound;
+	size_t page_cnt, bm_size, total_pages = 0;
+	size_t c;
 	uint32_t i;
+
+	base = ptov (0);
+	chunk_cnt = DIV_ROUND_UP (mem_end / PGSIZE, CHUNK_PAGES);
+	page_cnt = chunk_cnt * CHUNK_PAGES;
+	bm_size = bitmap_buf_size (page_cnt);
+
+	usable_map = bitmap_create_in_buf (page_cnt, buf, bm_size);
+	buf += bm_size;
+	kernel_pool.used_map = bitmap_create_in_buf (page_cnt, buf, bm_size);
+	buf += bm_size;
+	user_pool.used_map = bitmap_create_in_buf (page_cnt, buf, bm_size);
+	buf += bm_size;
+	chunk_usable = (uint16_t *) buf;
+	buf += chunk_cnt * sizeof *chunk_usable;
+	chunk_owner = buf;
+	buf += chunk_cnt;
+
+	// Everything below here, including the kernel, is in use.
+	usable_bound = vtop (pg_round_up (buf));
+	bitmap_set_all (usable_map, false);
 	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
 		struct e820_entry *entry = &entries[i];
 		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			start = (uint64_t) ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			end = start + size;
-			size_in_pg = size / PGSIZE;
-
-			if (state == KERN_START) {
-				region_start = start;
-				state = KERN;
-			}
-
-			switch (state) {
-				case KERN:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
-					// Transition to the next state
-					if (rem == size_in_pg) {
-						rem = user_pages;
-						state = USER_START;
-					} else {
-						region_start = start + rem * PGSIZE;
-						rem = user_pages - size_in_pg + rem;
-						state = USER;
-					}
-					break;
-				case USER_START:
-					region_start = start;
-					state = USER;
-					break;
-				case USER:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					ASSERT (rem == size);
-					break;
-				default:
-					NOT_REACHED ();
-			}
+			uint64_t start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
+			uint64_t end = start + APPEND_HILO (entry->len_hi, entry->len_lo);
+
+			start = ROUND_UP (start > usable_bound ? start : usable_bound,
+					PGSIZE);
+			end = end / PGSIZE * PGSIZE;
+			if (start < end)
+				bitmap_set_multiple (usable_map, start / PGSIZE,
+						(end - start) / PGSIZE, true);
 		}
 	}
 
-	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
-
-	// Iterate over the e820_entry. Setup the usable.
-	uint64_t usable_bound = (uint64_t) free_start;
-	struct pool *pool;
-	void *pool_end;
-	size_t page_idx, page_cnt;
-
-	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
-		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			uint64_t start = (uint64_t)
-				ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			uint64_t end = start + size;
-
-			// TODO: add 0x1000 ~ 0x200000, This is not a matter for now.
-			// All the pages are unuable
-			if (end < usable_bound)
-				continue;
-
-			start = (uint64_t)
-				pg_round_up (start >= usable_bound ? start : usable_bound);
-split:
-			if (page_from_pool (&kernel_pool, (void *) start))
-				pool = &kernel_pool;
-			else if (page_from_pool (&user_pool, (void *) start))
-				pool = &user_pool;
-			else
-				NOT_REACHED ();
-
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
-			page_idx = pg_no (start) - pg_no (pool->base);
-			if ((uint64_t) pool_end < end) {
-				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-				start = (uint64_t) pool_end;
-				goto split;
-			} else {
-				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-			}
+	lock_init (&balance_lock);
+	lock_init (&kernel_pool.lock);
+	kernel_pool.owner = CHUNK_KERNEL;
+	kernel_pool.min_free = KERNEL_MIN_FREE;
+	bitmap_set_all (kernel_pool.used_map, true);
+	lock_init (&user_pool.lock);
+	user_pool.owner = CHUNK_USER;
+	bitmap_set_all (user_pool.used_map, true);
+
+	for (c = 0; c < chunk_cnt; c++) {
+		chunk_usable[c] = bitmap_count (usable_map, c * CHUNK_PAGES,
+				CHUNK_PAGES, true);
+		total_pages += chunk_usable[c];
+	}
+	for (c = 0; c < chunk_cnt; c++) {
+		if (chunk_usable[c] == 0)
+			chunk_owner[c] = CHUNK_NONE;
+		else if (kernel_pool.owned_cnt < total_pages / 4)
+			chunk_give (c, CHUNK_KERNEL);
+		else if (user_pool.owned_cnt < total_pages / 4)
+			chunk_give (c, CHUNK_USER);
+		else {
+			chunk_owner[c] = CHUNK_RESERVE;
+			reserve_cnt += chunk_usable[c];
 		}
 	}
+
+	wmark[WMARK_LOW] = total_pages / 64;
+	wmark[WMARK_HIGH] = total_pages / 32;
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -261,27 +274,7 @@ palloc_init (void) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
-
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
-
-	if (pages) {
-		if (flags & PAL_ZERO)
-			memset (pages, 0, PGSIZE * page_cnt);
-	} else {
-		if (flags & PAL_ASSERT)
-			PANIC ("palloc_get: out of pages");
-	}
-
-	return pages;
+	return get_pages (flags, page_cnt, __builtin_return_address (0));
 }
 
 /* Obtains a single free page and returns its kernel virtual
@@ -293,7 +286,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	return get_pages (flags, 1, __builtin_return_address (0));
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
@@ -306,20 +299,22 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
-	page_idx = pg_no (pages) - pg_no (pool->base);
+	pool = pool_of (pages);
+	page_idx = pg_no (pages) - pg_no (base);
 
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	__atomic_fetch_add (&pool->free_cnt, page_cnt, __ATOMIC_RELAXED);
+	memstat_free (&pool->stat, PGSIZE * page_cnt);
+
+	/* Dying threads free their pages with interrupts off, so only
+	   try to shrink the pool where we could take a lock. */
+	if (pool->free_cnt >= TRIM_PAGES + (size_t) chunk_usable[page_idx / CHUNK_PAGES]
+			&& !intr_context () && intr_get_level () == INTR_ON)
+		pool_trim (pool, page_idx / CHUNK_PAGES);
 }
 
 /* Frees the page at PAGE. */
@@ -328,31 +323,188 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END */
-static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Palloc: kernel pool %zu of %zu pages free, "
+			"user pool %zu of %zu, reserve %zu\n",
+			kernel_pool.free_cnt, kernel_pool.owned_cnt,
+			user_pool.free_cnt, user_pool.owned_cnt, reserve_cnt);
+	memstat_print ("kernel", &kernel_pool.stat);
+	memstat_print ("user", &user_pool.stat);
+}
+
+/* Returns true if the pages user processes could still get, from
+   the user pool, the reserve, and whatever the kernel pool could
+   lend, number fewer than watermark W.  This is the signal to
+   start reclaiming (below WMARK_LOW) or to stop (not below
+   WMARK_HIGH).  The counts are read without locking, so the
+   answer is approximate. */
+bool
+palloc_below_wmark (enum palloc_wmark w) {
+	size_t avail = user_pool.free_cnt + reserve_cnt;
+	size_t in_use = user_pool.owned_cnt - user_pool.free_cnt;
+
+	if (kernel_pool.free_cnt > KERNEL_MIN_FREE)
+		avail += kernel_pool.free_cnt - KERNEL_MIN_FREE;
+	if (in_use >= user_page_limit)
+		avail = 0;
+	else if (avail > user_page_limit - in_use)
+		avail = user_page_limit - in_use;
+	return avail < wmark[w];
+}
+
+/* Does the work for palloc_get_multiple() and palloc_get_page(),
+   crediting the allocation to call site SITE. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, void *site) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = BITMAP_ERROR;
+	void *pages = NULL;
+
+	if (pool != &user_pool
+			|| user_pool.owned_cnt - user_pool.free_cnt + page_cnt
+			<= user_page_limit) {
+		do {
+			lock_acquire (&pool->lock);
+			page_idx = bitmap_scan_and_flip_next (pool->used_map, page_cnt,
+					false);
+			lock_release (&pool->lock);
+		} while (page_idx == BITMAP_ERROR && pool_grow (pool, page_cnt));
+	}
+
+	if (page_idx != BITMAP_ERROR) {
+		__atomic_fetch_sub (&pool->free_cnt, page_cnt, __ATOMIC_RELAXED);
+		pages = base + PGSIZE * page_idx;
+		memstat_alloc (&pool->stat, PGSIZE * page_cnt, site);
+	} else
+		memstat_fail (&pool->stat);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
+/* Returns the pool whose chunk contains PAGE. */
+static struct pool *
+pool_of (const void *page) {
+	size_t page_idx = pg_no (page) - pg_no (base);
+
+	ASSERT (page_idx < chunk_cnt * CHUNK_PAGES);
+	switch (chunk_owner[page_idx / CHUNK_PAGES]) {
+		case CHUNK_KERNEL:
+			return &kernel_pool;
+		case CHUNK_USER:
+			return &user_pool;
+		default:
+			NOT_REACHED ();
+	}
+}
 
-	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
-	p->base = (void *) start;
+/* Returns true if none of CHUNK's usable pages is allocated from
+   POOL, which owns it. */
+static bool
+chunk_is_free (size_t chunk, struct pool *pool) {
+	return bitmap_count (pool->used_map, chunk * CHUNK_PAGES, CHUNK_PAGES,
+			false) == chunk_usable[chunk];
+}
 
-	// Mark all to unusable.
-	bitmap_set_all(p->used_map, true);
+/* Hands the usable pages of CHUNK to the pool tagged OWNER.  The
+   caller holds balance_lock, or we are still booting. */
+static void
+chunk_give (size_t chunk, enum chunk_owner owner) {
+	struct pool *pool = owner == CHUNK_KERNEL ? &kernel_pool : &user_pool;
+	size_t start = chunk * CHUNK_PAGES;
+	size_t i;
+
+	chunk_owner[chunk] = owner;
+	for (i = start; i < start + CHUNK_PAGES; i++)
+		if (bitmap_test (usable_map, i))
+			bitmap_reset (pool->used_map, i);
+	pool->owned_cnt += chunk_usable[chunk];
+	__atomic_fetch_add (&pool->free_cnt, chunk_usable[chunk],
+			__ATOMIC_RELAXED);
+}
 
-	*bm_base += bm_pages;
+/* Takes CHUNK, which is entirely free, away from POOL.  The
+   caller holds balance_lock and POOL's lock. */
+static void
+chunk_take (size_t chunk, struct pool *pool) {
+	ASSERT (chunk_owner[chunk] == pool->owner);
+
+	bitmap_set_multiple (pool->used_map, chunk * CHUNK_PAGES, CHUNK_PAGES,
+			true);
+	__atomic_fetch_sub (&pool->free_cnt, chunk_usable[chunk],
+			__ATOMIC_RELAXED);
+	pool->owned_cnt -= chunk_usable[chunk];
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/* Gives POOL one more chunk: from the reserve if it has any,
+   otherwise a free chunk from the other pool, as long as that
+   leaves the other pool its minimum.  For runs of more than one
+   page, prefers a reserve chunk next to one POOL already owns so
+   that the run can span both.  Returns false if there is no
+   chunk to give. */
 static bool
-page_from_pool (const struct pool *pool, void *page) {
-	size_t page_no = pg_no (page);
-	size_t start_page = pg_no (pool->base);
-	size_t end_page = start_page + bitmap_size (pool->used_map);
-	return page_no >= start_page && page_no < end_page;
+pool_grow (struct pool *pool, size_t page_cnt) {
+	struct pool *other = pool == &kernel_pool ? &user_pool : &kernel_pool;
+	size_t pick = chunk_cnt;
+	size_t c;
+
+	lock_acquire (&balance_lock);
+	for (c = 0; c < chunk_cnt; c++) {
+		if (chunk_owner[c] != CHUNK_RESERVE)
+			continue;
+		if (pick == chunk_cnt)
+			pick = c;
+		if (page_cnt == 1
+				|| (c > 0 && chunk_owner[c - 1] == pool->owner)
+				|| (c + 1 < chunk_cnt && chunk_owner[c + 1] == pool->owner)) {
+			pick = c;
+			break;
+		}
+	}
+
+	if (pick != chunk_cnt) {
+		reserve_cnt -= chunk_usable[pick];
+	} else {
+		lock_acquire (&other->lock);
+		for (c = 0; c < chunk_cnt; c++)
+			if (chunk_owner[c] == other->owner
+					&& other->free_cnt >= other->min_free + chunk_usable[c]
+					&& chunk_is_free (c, other)) {
+				chunk_take (c, other);
+				pick = c;
+				break;
+			}
+		lock_release (&other->lock);
+	}
+
+	if (pick != chunk_cnt)
+		chunk_give (pick, pool->owner);
+	lock_release (&balance_lock);
+	return pick != chunk_cnt;
+}
+
+/* Returns CHUNK to the reserve if POOL owns it and it is entirely
+   free.  Never sleeps: gives up if either lock is busy. */
+static void
+pool_trim (struct pool *pool, size_t chunk) {
+	if (!lock_try_acquire (&balance_lock))
+		return;
+	if (lock_try_acquire (&pool->lock)) {
+		if (chunk_owner[chunk] == pool->owner && chunk_is_free (chunk, pool)) {
+			chunk_take (chunk, pool);
+			chunk_owner[chunk] = CHUNK_RESERVE;
+			reserve_cnt += chunk_usable[chunk];
+		}
+		lock_release (&pool->lock);
+	}
+	lock_release (&balance_lock);
 }
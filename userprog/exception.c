@@ -1,7 +1,9 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <syscall-nr.h>
 #include "userprog/gdt.h"
+#include "userprog/uaccess.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "intrinsic.h"
@@ -9,8 +11,22 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+/* Page faults of each FAULT_* type, the TSC cycles they took to
+   handle in all, and a histogram of the cycles each took, with
+   buckets as described in lib/syscall-nr.h.  Each process also
+   keeps counts of its own in its supplemental page table. */
+static uint64_t fault_cnt[FAULT_TYPE_CNT];
+static uint64_t fault_cycles[FAULT_TYPE_CNT];
+static uint64_t fault_hist[FAULT_TYPE_CNT][FAULT_HIST_BUCKETS];
+
+/* Names of the fault types, for exception_print_stats(). */
+static const char *fault_names[FAULT_TYPE_CNT] = {
+	"lazy-load", "zero-fill", "swap-in", "cow", "stack", "fatal",
+};
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void inspect_fault_cnt (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -58,12 +74,73 @@ exception_init (void) {
 	   We need to disable interrupts for page faults because the
 	   fault address is stored in CR2 and needs to be preserved. */
 	intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+	/* Tool for reading the page fault counters; see
+	   inspect_fault_cnt(). */
+	intr_register_int (0x45, 3, INTR_OFF, inspect_fault_cnt,
+			"Inspect Page Fault Count");
 }
 
 /* Prints exception statistics. */
 void
 exception_print_stats (void) {
+	int type, b;
+
 	printf ("Exception: %lld page faults\n", page_fault_cnt);
+	for (type = 0; type < FAULT_TYPE_CNT; type++) {
+		if (fault_cnt[type] == 0)
+			continue;
+		printf ("  %-9s %8"PRIu64" faults %10"PRIu64" cycles avg\n",
+				fault_names[type], fault_cnt[type],
+				fault_cycles[type] / fault_cnt[type]);
+		for (b = 0; b < FAULT_HIST_BUCKETS; b++)
+			if (fault_hist[type][b] != 0)
+				printf ("    < 2^%-2d cycles %8"PRIu64"\n",
+						b, fault_hist[type][b]);
+	}
+}
+
+/* Counts a page fault of the given TYPE, whose handling started at
+   TSC value START. */
+static void
+count_fault (int type, uint64_t start) {
+	uint64_t cycles = rdtsc () - start;
+	int bucket = cycles == 0 ? 0 : 64 - __builtin_clzll (cycles);
+
+	if (bucket >= FAULT_HIST_BUCKETS)
+		bucket = FAULT_HIST_BUCKETS - 1;
+	__atomic_fetch_add (&fault_cnt[type], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&fault_cycles[type], cycles, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&fault_hist[type][bucket], 1, __ATOMIC_RELAXED);
+#ifdef VM
+	thread_current ()->spt.fault_cnt[type]++;
+#endif
+}
+
+/* Tool for reading page fault statistics. Calling this function via
+   int 0x45.
+   Input:
+     @RDX - Type of page fault, one of the FAULT_* types
+     @RCX - Histogram bucket to read, or -1 for the number of faults
+            of the type, or -2 for the number the current process took
+   Output:
+     @RAX - Number of faults, or 0 if the input is out of range. */
+static void
+inspect_fault_cnt (struct intr_frame *f) {
+	uint64_t type = f->R.rdx;
+	int64_t which = f->R.rcx;
+
+	f->R.rax = 0;
+	if (type >= FAULT_TYPE_CNT)
+		return;
+	if (which == -1)
+		f->R.rax = fault_cnt[type];
+#ifdef VM
+	else if (which == -2)
+		f->R.rax = thread_current ()->spt.fault_cnt[type];
+#endif
+	else if (which >= 0 && which < FAULT_HIST_BUCKETS)
+		f->R.rax = fault_hist[type][which];
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -122,6 +199,10 @@ page_fault (struct intr_frame *f) {
 	bool write;        /* True: access was write, false: access was read. */
 	bool user;         /* True: access by user, false: access by kernel. */
 	void *fault_addr;  /* Fault address. */
+	uint64_t start = rdtsc ();
+#ifdef VM
+	int type;
+#endif
 
 	/* Obtain faulting address, the virtual address that was
 	   accessed to cause the fault.  It may point to code or to
@@ -139,19 +220,27 @@ page_fault (struct intr_frame *f) {
 	not_present = (f->error_code & PF_P) == 0;
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
-	
-	exit(-1);
+
+	/* Count page faults. */
+	__atomic_fetch_add (&page_fault_cnt, 1, __ATOMIC_RELAXED);
 
 #ifdef VM
 	/* For project 3 and later. */
-	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
+	if (vm_try_handle_fault (f, fault_addr, user, write, not_present,
+				&type)) {
+		count_fault (type, start);
 		return;
+	}
 #endif
 
-	// exit(-1);
-	
-	/* Count page faults. */
-	page_fault_cnt++;
+	/* A bad user pointer that the kernel was given; the access that
+	   faulted reports the failure to its caller, and the fault is not
+	   fatal. */
+	if (!user && fixup_exception (f))
+		return;
+
+	count_fault (FAULT_FATAL, start);
+	exit(-1);
 
 	/* If the fault is true fault, show info and exit. */
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
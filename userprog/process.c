@@ -13,6 +13,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -397,8 +398,13 @@ process_cleanup (void) {
  * This function is called on every context switch. */
 void
 process_activate (struct thread *next) {
-	/* Activate thread's page tables. */
-	pml4_activate (next->pml4);
+	/* Activate thread's page tables.  A kernel-only thread never
+	 * touches user memory, so it simply borrows whichever pml4 is
+	 * loaded (lazy TLB); switching back to that process then costs
+	 * no CR3 load at all.  Only the owner ever destroys a pml4, and
+	 * it loads base_pml4 first, so the borrowed one stays valid. */
+	if (next->pml4 != NULL)
+		pml4_activate (next->pml4);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update (next);
@@ -726,11 +732,35 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* What lazy_load_segment() needs to fill one page of a segment.
+ * Allocated with malloc() and owned by the page until loaded. */
+struct segment_aux {
+	struct file *file;          /* Executable. */
+	off_t ofs;                  /* Offset of the page's data in FILE. */
+	size_t read_bytes;          /* Bytes to read; the rest are zeroed. */
+};
+
+/* Reads a page of a segment on its first fault. */
 static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+lazy_load_segment (struct page *page, void *aux_) {
+	struct segment_aux *aux = aux_;
+	uint8_t *kva = page->frame->kva;
+	bool locked = lock_held_by_current_thread (&filesys_lock);
+	bool success;
+
+	/* A fault can come from inside a system call that already holds
+	 * the file system lock. */
+	if (!locked)
+		lock_acquire (&filesys_lock);
+	success = file_read_at (aux->file, kva, aux->read_bytes, aux->ofs)
+		== (off_t) aux->read_bytes;
+	if (!locked)
+		lock_release (&filesys_lock);
+
+	memset (kva + aux->read_bytes, 0, PGSIZE - aux->read_bytes);
+	free (aux);
+	page->anon.file_data = true;
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -754,6 +784,10 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
+	if (!vma_add (&thread_current ()->spt, upage,
+				upage + read_bytes + zero_bytes, VMA_PRIVATE))
+		return false;
+
 	while (read_bytes > 0 || zero_bytes > 0) {
 		/* Do calculate how to fill this page.
 		 * We will read PAGE_READ_BYTES bytes from FILE
@@ -761,16 +795,38 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+		/* A page with nothing to read is a plain anonymous page,
+		 * which starts out mapped to the shared zero frame. */
+		if (page_read_bytes == 0) {
+			if (!vm_alloc_page (VM_ANON, upage, writable))
+				return false;
+		} else if (!writable && (page_read_bytes == PGSIZE
+					|| ofs + (off_t) page_read_bytes >= file_length (file))) {
+			/* Read-only text is shared with every other process
+			 * running the same executable, through the page cache,
+			 * whose page reads as zeros past the end of the file but
+			 * not past the end of the segment. */
+			if (!text_alloc_page (upage, file_get_inode (file), ofs))
+				return false;
+		} else {
+			struct segment_aux *aux = malloc (sizeof *aux);
+			if (aux == NULL)
+				return false;
+			aux->file = file;
+			aux->ofs = ofs;
+			aux->read_bytes = page_read_bytes;
+			if (!vm_alloc_page_with_initializer (VM_ANON, upage,
+						writable, lazy_load_segment, aux)) {
+				free (aux);
+				return false;
+			}
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
 	return true;
 }
@@ -781,10 +837,15 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	/* The stack may grow down to STACK_LIMIT. */
+	if (vma_add (&thread_current ()->spt,
+				(uint8_t *) USER_STACK - STACK_LIMIT, (void *) USER_STACK,
+				VMA_STACK)
+			&& vm_alloc_page (VM_ANON | VM_STACK, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		success = true;
+		if_->rsp = USER_STACK;
+	}
 
 	return success;
 }
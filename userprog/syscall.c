@@ -6,17 +6,22 @@
 #include "threads/loader.h"
 #include "userprog/gdt.h"
 #include "userprog/process.h"
+#include "userprog/uaccess.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 #include "include/filesys/filesys.h"
 #include "threads/init.h"
 #include "threads/palloc.h"
+#include "devices/input.h"
 #include "include/lib/stdio.h"
 #include "include/filesys/file.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
-void check_address (void *addr);
+bool copy_in_name (char *name, const char *uname);
 void halt (void);
 void exit (int status);
 bool create (const char *file, unsigned initial_size);
@@ -31,6 +36,11 @@ void close (int fd);
 tid_t fork (const char *thread_name, struct intr_frame *f);
 int wait (tid_t child_tid UNUSED);
 int exec (const char *cmd_line);
+#ifdef VM
+void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+#endif
 
 int add_file_to_fd_table (struct file *file);
 struct file *get_file_from_fd_table (int fd);
@@ -49,12 +59,66 @@ void close_file_from_fd_table (int fd);
 #define MSR_LSTAR 0xc0000082        /* Long mode SYSCALL target */
 #define MSR_SYSCALL_MASK 0xc0000084 /* Mask for the eflags */
 
-void
-check_address (void *uaddr) {											// SJ, 유저 프로그램이 시스템 콜을 요청할 때 요청한 포인터 인자가 NULL이거나, 커널 공간을 가르키는 포인터이거나, 가상 메모리에 맵핑되어 있지 않다면 프로세스를 종료시킨다.
-	struct thread *current_thread = thread_current();
-	
-	if (uaddr == NULL || is_kernel_vaddr(uaddr) || pml4_get_page(current_thread->pml4, uaddr) == NULL) {
+/* Longest file name copied in from a user program, null included. */
+#define NAME_BUF_SIZE 256
+
+/* Size of the kernel buffer that console I/O goes through. */
+#define CONSOLE_BUF_SIZE 512
+
+/* Copies the file name at user address UNAME into NAME, which has
+ * room for NAME_BUF_SIZE bytes.  Kills the process if UNAME is a bad
+ * pointer.  Returns false if the name is too long to be valid. */
+bool
+copy_in_name (char *name, const char *uname) {
+	int len = strncpy_from_user (name, uname, NAME_BUF_SIZE);
+
+	if (len < 0)
+		exit(-1);
+	return len < NAME_BUF_SIZE;
+}
+
+/* Reads keys into user BUFFER until SIZE bytes or a null byte have
+ * been read, and returns the number read, not counting the null.
+ * The keys are gathered in a kernel buffer and copied out with
+ * copy_to_user(), so the user buffer need not be resident while the
+ * process waits for input.  Kills the process if BUFFER is bad. */
+static int
+read_console (uint8_t *buffer, unsigned size) {
+	uint8_t keys[CONSOLE_BUF_SIZE];
+	unsigned read_count = 0;
+	bool null = false;
+
+	while (read_count < size && !null) {
+		unsigned cnt = 0;
+
+		while (cnt < sizeof keys && read_count + cnt < size && !null) {
+			keys[cnt] = input_getc ();
+			null = keys[cnt++] == '\0';
+		}
+		if (copy_to_user (buffer + read_count, keys, cnt) != 0)
+			exit(-1);
+		read_count += cnt;
+	}
+	return null ? read_count - 1 : read_count;
+}
+
+/* Writes SIZE bytes from user BUFFER to the console, copying them in
+ * with copy_from_user() a kernel buffer at a time.  Each buffer goes
+ * out in one putbuf(), so writes of up to CONSOLE_BUF_SIZE bytes are
+ * not interleaved with other output.  Kills the process if BUFFER is
+ * bad, before printing any of it: the whole buffer is checked first. */
+static void
+write_console (const uint8_t *buffer, unsigned size) {
+	uint8_t bytes[CONSOLE_BUF_SIZE];
+	unsigned done, cnt;
+
+	if (!fault_in_user ((void *) buffer, size, false))
 		exit(-1);
+	for (done = 0; done < size; done += cnt) {
+		cnt = size - done < sizeof bytes ? size - done : sizeof bytes;
+		if (copy_from_user (bytes, buffer + done, cnt) != 0)
+			exit(-1);
+		putbuf ((const char *) bytes, cnt);
 	}
 }
 
@@ -78,6 +142,10 @@ void
 syscall_handler (struct intr_frame *f UNUSED) {							// SJ, 시스템 콜이 호출되면 시스템 콜 핸들러가 이 시스템 콜을 어떻게 다뤄야 할지 중재한다.
 	// TODO: Your implementation goes here.
 	// int syscall_number = f->R.rax;									// SJ, 사용자 프로그램이 어떤 시스템 콜을 요청한 것인지 확인해야 한다.
+#ifdef VM
+	/* Page faults in the kernel check stack growth against this. */
+	thread_current ()->user_rsp = (void *) f->rsp;
+#endif
 	
 	switch(f->R.rax) {
 		case SYS_HALT:
@@ -122,6 +190,17 @@ syscall_handler (struct intr_frame *f UNUSED) {							// SJ, 시스템 콜이 
 		case SYS_EXEC:
 			f->R.rax = exec(f->R.rdi);
 			break;
+#ifdef VM
+		case SYS_MMAP:
+			f->R.rax = (uint64_t) mmap((void *) f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+			break;
+		case SYS_MUNMAP:
+			munmap((void *) f->R.rdi);
+			break;
+		case SYS_MADVISE:
+			f->R.rax = madvise((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			break;
+#endif
 		default:
 			exit(-1);
 			break;
@@ -143,37 +222,43 @@ exit (int status) {
 
 bool
 create (const char *file, unsigned initial_size) {
-	check_address(file);
+	char name[NAME_BUF_SIZE];
+
+	if (!copy_in_name(name, file))
+		return false;
 	
 	// lock_acquire(&filesys_lock);
 	// bool result = filesys_create(file, initial_size);
 	// lock_release(&filesys_lock);
 	// return result;
 	
-	return filesys_create(file, initial_size);														// SJ, file 생성 성공 시 true를 반환한다.
+	return filesys_create(name, initial_size);														// SJ, file 생성 성공 시 true를 반환한다.
 }
 
 bool
 remove (const char *file) {
-	check_address(file);
+	char name[NAME_BUF_SIZE];
+
+	if (!copy_in_name(name, file))
+		return false;
 	
 	// lock_acquire(&filesys_lock);
 	// bool result = filesys_remove(file);
 	// lock_release(&filesys_lock);
 	// return result;
 	
-	return filesys_remove(file);														// SJ, file 제거 성공 시 true를 반환한다.
+	return filesys_remove(name);														// SJ, file 제거 성공 시 true를 반환한다.
 }
 
 int 
 open (const char *file) {												// SJ, 디렉토리를 열어서? 디스크에서? 해당하는 파일을 찾아서, 그 파일만큼 메모리를 할당받고(filesys_open 안의 file_open에서 calloc) 파일 테이블에서 빈 fd에(add_file_to_fd_table) open한 파일을 배정시킨다.
-	check_address(file);
-	
-	if (file == NULL) {
+	char name[NAME_BUF_SIZE];
+
+	if (!copy_in_name(name, file)) {
 		return -1;
 	}
 	
-	struct file *file_object = filesys_open(file);	
+	struct file *file_object = filesys_open(name);	
 			
 	if (file_object == NULL) {
 		return -1;
@@ -204,67 +289,61 @@ filesize (int fd) {														// SJ, 파일의 사이즈를 반환한다. off
 
 int
 read (int fd, void *buffer, unsigned size) {		// SJ, fd로부터 size만큼 읽어서 buffer에 담아라. fd가 0이면 키보드 버퍼로부터 size만큼 읽어서 buffer에 담아라.
-	check_address(buffer);							// SJ, read할 첫 부분을 체크(커널 공간이면 바로 빠꾸)
-	// check_address(buffer + size - 1);				// SJ, 맨 끝 읽으려는 부분이 커널 공간일 수도 있기 때문에 맨 끝도 검사해준다. 맨 처음도 쳐주기 때문에 -1을 해준다.
-	
 	int read_count;
 	struct file *file = get_file_from_fd_table(fd);
 	
-	if (file == NULL || file <= 0 || fd == STDOUT_FILENO || fd < 0) {
+	if (file == NULL || file <= 0 || fd == STDOUT_FILENO || fd < 0)
 		return -1;
-	}
-	
-	if (fd == STDIN_FILENO) {						// SJ, 키보드 입력을 통해 저장되어 있는 버퍼로부터 읽어온다.
-		unsigned char *buf = buffer;				// SJ, 주소값에는 음수가 없다. 그리고 문자열에 접근할 때는 unsigned를 사용한다. 그냥 buffer를 그대로 쓰면, 나중에 buffer++하면서 주소값이 변할 수 있다. 즉 원본 buffer 주소를 나중에 쓸 수도 있는데, 원하는 처음 주소가 아닐 수도 있다.
-		char key;									// SJ, 한 글자 한 글자
-		
-		// lock_acquire(&filesys_lock);
-		for (read_count = 0; read_count < size; read_count++) {			
-			key = input_getc();						// SJ, 불릴 때마다 하나씩 옮겨가면서 읽어온다. intr_disable을 통해 인터럽트를 무시하고 있다. 즉 input_getc 함수 자체적으로 동기화를 구현하고 있다.
-			*buf++ = key;							// SJ, buf가 가르키는 곳에 key라는 문자열을 넣는다.
-			
-			if (key == '\0') {						// SJ, 마지막 문자를 만나면 넣는 것을 멈춘다.
-				break;
-			}
-		}
-		// lock_release(&filesys_lock);
-	}
-	
-	else {
-		lock_acquire(&filesys_lock);
-		read_count = file_read(file, buffer, size);
-		lock_release(&filesys_lock);
-	}
-	
+	if (fd == STDIN_FILENO)
+		return read_console(buffer, size);
+
+#ifdef VM
+	/* Bring in the whole buffer and keep it resident while we fill it. */
+	if (!vm_pin_range(buffer, size, true))
+		exit(-1);
+#else
+	/* Every page of the buffer must be writable, not just the first. */
+	if (!fault_in_user(buffer, size, true))
+		exit(-1);
+#endif
+	lock_acquire(&filesys_lock);
+	read_count = file_read(file, buffer, size);
+	lock_release(&filesys_lock);
+	
+#ifdef VM
+	vm_unpin_range(buffer, size);
+#endif
 	return read_count;
 }
 
 int
 write (int fd, const void *buffer, unsigned size) {						// SJ, buffer에서 size만큼 복사해서 fd에 작성해라. fd가 1이면, buffer에서 size만큼 복사해서 콘솔(모니터)에 넣어라.
-	check_address(buffer);
-	check_address(buffer + size - 1);									// SJ, 쓰려는 공간이 커널 공간일 수도 있기 때문에 체크해준다.
 	unsigned result;
 	
 	struct file *file = get_file_from_fd_table(fd);
 	
-	if (file == NULL || fd <= STDIN_FILENO || file <= 1) {
-		result = -1;
-	}
-	
-	else if (fd == STDOUT_FILENO) {										// SJ, 버퍼에 저장된 값을 화면에 출력해준다.
-		// lock_acquire(&filesys_lock);
-		putbuf(buffer, size);											// SJ, putbuf 함수 내부적으로 console에 대해 락이 구현되어 있다.
-		// lock_release(&filesys_lock);								
-		result = size;
-	}
-	
-	else {
-		lock_acquire(&filesys_lock);
-		int write_count = file_write(file, buffer, size);
-		lock_release(&filesys_lock);
-		result = write_count;
+	if (file == NULL || fd <= STDIN_FILENO || file <= 1)
+		return -1;
+	if (fd == STDOUT_FILENO) {
+		write_console(buffer, size);
+		return size;
 	}
-	
+
+#ifdef VM
+	/* Bring in the whole buffer and keep it resident while we copy it out. */
+	if (!vm_pin_range(buffer, size, false))
+		exit(-1);
+#else
+	if (!fault_in_user((void *) buffer, size, false))
+		exit(-1);
+#endif
+	lock_acquire(&filesys_lock);
+	result = file_write(file, buffer, size);
+	lock_release(&filesys_lock);
+	
+#ifdef VM
+	vm_unpin_range(buffer, size);
+#endif
 	return result;
 }
 
@@ -325,21 +404,54 @@ wait (tid_t child_tid UNUSED) {							// SJ, 부모 프로세스는 자식 프
 														// SJ, child_tid에 대해 이미 wait을 호출했는데 또 wait을 호출한다면, 혹은 child_tid가 부모 프로세스의 자식이 아니라면 -1을 반환한다.
 														
 int exec (const char *file_name) {
-	check_address(file_name);
-
-	int file_size = strlen(file_name) + 1;
-	char *fn_copy = palloc_get_page(PAL_ZERO);
+	char *fn_copy = palloc_get_page(0);
 	if (!fn_copy) {
 		exit(-1);
 		return -1;
 	}
-	strlcpy(fn_copy, file_name, file_size);
+	/* A command line that does not fit in the page is cut short. */
+	if (strncpy_from_user(fn_copy, file_name, PGSIZE) < 0) {
+		palloc_free_page(fn_copy);
+		exit(-1);
+		return -1;
+	}
+	fn_copy[PGSIZE - 1] = '\0';
 	if (process_exec(fn_copy) == -1) {
 		exit(-1);
 		return -1;
 	}
 }				
-								
+
+#ifdef VM
+void *
+mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
+	struct file *file;
+
+	/* FD -1 maps anonymous memory. */
+	if (fd == -1) {
+		return do_mmap(addr, length, writable, NULL, offset);
+	}
+
+	/* The console has nothing to map. */
+	file = get_file_from_fd_table(fd);
+	if (file == NULL || fd <= STDOUT_FILENO) {
+		return NULL;
+	}
+
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+void
+munmap (void *addr) {
+	do_munmap(addr);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return do_madvise(addr, length, advice);
+}
+#endif
+
 // SJ, file descriptor table 관련 helper functions
 int 
 add_file_to_fd_table (struct file *file) {
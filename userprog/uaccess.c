@@ -0,0 +1,170 @@
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+
+/* Access to user memory from the kernel.
+
+   Rather than look each user pointer up in the page tables before
+   using it, the kernel simply uses it, through the routines below,
+   and leaves the rare access that faults to the page fault handler.
+   With virtual memory, most such faults are handled like any other,
+   and the access is retried.  A fault that cannot be handled would
+   otherwise be taken for a bug in the kernel; instead, page_fault()
+   calls fixup_exception(), which looks the faulting instruction up
+   in the exception table and, if it is one of the accesses below,
+   resumes at the fixup address listed for it, from where the routine
+   returns failure.
+
+   The page tables do not keep the kernel out of kernel memory, so
+   each routine first checks with access_ok() that the whole range
+   lies in user space. */
+
+/* An entry in the exception table. */
+struct exception_entry {
+	uintptr_t insn;             /* Instruction that may fault. */
+	uintptr_t fixup;            /* Where to resume if it does. */
+};
+
+/* The exception table, which the linker script gathers from the
+   __ex_table sections. */
+extern const struct exception_entry __start___ex_table[];
+extern const struct exception_entry __stop___ex_table[];
+
+/* Assembly that adds an exception table entry for the instruction at
+   label FROM, resuming at label TO. */
+#define EX_TABLE(FROM, TO)                      \
+	".pushsection __ex_table, \"a\"\n"          \
+	".balign 8\n"                               \
+	".quad " #FROM ", " #TO "\n"                \
+	".popsection\n"
+
+/* Returns true if [UADDR, UADDR + SIZE) lies in user space. */
+bool
+access_ok (const void *uaddr, size_t size) {
+	uintptr_t start = (uintptr_t) uaddr;
+
+	return size == 0
+		|| (start + size > start && is_user_vaddr (start + size - 1));
+}
+
+/* Copies SIZE bytes from SRC to DST, one of which is in user space,
+   and returns the number of bytes left uncopied when an access
+   faulted, or 0. */
+static size_t
+copy_user (void *dst, const void *src, size_t size) {
+	/* A fault leaves RCX counting the bytes not yet copied. */
+	asm volatile ("1: rep movsb\n"
+			"2:\n"
+			EX_TABLE (1b, 2b)
+			: "+D" (dst), "+S" (src), "+c" (size)
+			:
+			: "memory");
+	return size;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns the
+   number of bytes that could not be copied, so 0 on success. */
+size_t
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	if (!access_ok (usrc, size))
+		return size;
+	return copy_user (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns the
+   number of bytes that could not be copied, so 0 on success. */
+size_t
+copy_to_user (void *udst, const void *src, size_t size) {
+	if (!access_ok (udst, size))
+		return size;
+	return copy_user (udst, src, size);
+}
+
+/* Reads the byte at user address UADDR, which must be in user space,
+   into *BYTE.  Returns false if the access faulted. */
+static inline bool
+get_user (uint8_t *byte, const uint8_t *uaddr) {
+	int fault = 0;
+	uint8_t value;
+
+	asm volatile ("1: movb (%2), %1\n"
+			"jmp 3f\n"
+			"2: movl $1, %0\n"
+			"3:\n"
+			EX_TABLE (1b, 2b)
+			: "+r" (fault), "=q" (value)
+			: "r" (uaddr)
+			: "memory");
+	*byte = value;
+	return !fault;
+}
+
+/* Writes BYTE to user address UADDR, which must be in user space.
+   Returns false if the access faulted. */
+static inline bool
+put_user (uint8_t *uaddr, uint8_t byte) {
+	int fault = 0;
+
+	asm volatile ("1: movb %b2, (%1)\n"
+			"jmp 3f\n"
+			"2: movl $1, %0\n"
+			"3:\n"
+			EX_TABLE (1b, 2b)
+			: "+r" (fault)
+			: "r" (uaddr), "q" (byte)
+			: "memory");
+	return !fault;
+}
+
+/* Copies the null-terminated string at user address USRC into DST,
+   which has room for SIZE bytes, null included.  Returns the length
+   of the string, or SIZE if it does not fit, in which case DST is
+   not null-terminated, or -1 if an access faulted. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	const uint8_t *src = (const uint8_t *) usrc;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (!is_user_vaddr (src + i) || !get_user ((uint8_t *) &dst[i], src + i))
+			return -1;
+		if (dst[i] == '\0')
+			return i;
+	}
+	return size;
+}
+
+/* Touches every page of [UADDR, UADDR + SIZE), for writing if WRITE,
+   so that the kernel can then access the range directly.  Each page
+   is checked in full, not just at the ends of the range.  Returns
+   false if any part of the range cannot be accessed. */
+bool
+fault_in_user (void *uaddr, size_t size, bool write) {
+	uint8_t *start = uaddr;
+	uint8_t *end = start + size;
+	uint8_t *p;
+	uint8_t byte;
+
+	if (!access_ok (uaddr, size))
+		return false;
+	for (p = start; p < end; p = (uint8_t *) pg_round_down (p) + PGSIZE)
+		if (!get_user (&byte, p) || (write && !put_user (p, byte)))
+			return false;
+	return true;
+}
+
+/* If F is a fault on one of the accesses to user memory above, makes
+   F resume at the access's fixup code and returns true.  Otherwise,
+   returns false. */
+bool
+fixup_exception (struct intr_frame *f) {
+	const struct exception_entry *e;
+
+	for (e = __start___ex_table; e < __stop___ex_table; e++)
+		if (e->insn == f->rip) {
+			f->rip = e->fixup;
+			return true;
+		}
+	return false;
+}
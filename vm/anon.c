@@ -1,7 +1,14 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall-nr.h>
 #include "devices/disk.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +24,60 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Swap space.
+ *
+ * The swap disk is divided into page-sized slots of SLOT_SECTORS
+ * sectors, and SLOT_MAP has a bit set for every slot in use.
+ * SLOT_PAGE records the page in each slot in use.  A frame shared by
+ * several pages goes to a single slot, which they all refer to, and
+ * SLOT_REFS counts them; such a slot's SLOT_PAGE may be null.
+ *
+ * A PIO transfer costs mostly per command, not per sector, so
+ * pages go out in clusters: the evictor brackets a batch of
+ * victims with swap_cluster_begin() and swap_cluster_end(), the
+ * victims' pages are given consecutive slots of a reserved run,
+ * and each run is written with one command.  Pages evicted
+ * together are mostly neighbours in some process's address space,
+ * so swap-in reads the neighbours found in the adjacent slots
+ * along with the page that faulted, again with one command.
+ *
+ * Before any of that, a page is offered to the compressed pool in
+ * zswap.c, and only reaches the disk if the pool does not take it. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+static struct lock swap_lock;           /* Protects everything below. */
+static struct bitmap *slot_map;         /* Slots in use. */
+static struct page **slot_page;         /* Page in each slot in use. */
+static unsigned *slot_refs;             /* Pages referring to each. */
+static void *sectors[SWAP_CLUSTER * SLOT_SECTORS];  /* For disk I/O. */
+
+/* The cluster being filled: slots FIRST...FIRST + RESERVED - 1 are
+ * reserved for it, and the first CNT of them hold the pages whose
+ * frames are in KVA[], waiting to be written. */
+static struct {
+	size_t first;
+	size_t reserved;
+	size_t cnt;
+	void *kva[SWAP_CLUSTER];
+} cluster;
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	size_t slot_cnt;
+
+	lock_init (&swap_lock);
+	zswap_init ();
+	swap_disk = disk_get (1, 1);
+	if (swap_disk == NULL)
+		return;
+
+	slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+	slot_map = bitmap_create (slot_cnt);
+	slot_page = calloc (slot_cnt, sizeof *slot_page);
+	slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+	if (slot_map == NULL || slot_page == NULL || slot_refs == NULL)
+		PANIC ("no memory for %zu swap slots", slot_cnt);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +87,223 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_NONE;
+	anon_page->zswap = ZSWAP_NONE;
+	anon_page->file_data = false;
+	return true;
+}
+
+/* Fills SECTORS[] with the sectors of the CNT pages in KVA[], in
+ * order. */
+static void
+set_sectors (void *const kva[], size_t cnt) {
+	size_t i;
+
+	for (i = 0; i < cnt * SLOT_SECTORS; i++)
+		sectors[i] = (uint8_t *) kva[i / SLOT_SECTORS]
+			+ i % SLOT_SECTORS * DISK_SECTOR_SIZE;
+}
+
+/* Writes out the pages queued in the cluster and gives back the
+ * slots reserved for it that went unused. */
+static void
+cluster_flush (void) {
+	if (cluster.cnt > 0) {
+		set_sectors (cluster.kva, cluster.cnt);
+		disk_write_multiple (swap_disk, cluster.first * SLOT_SECTORS,
+				(const void *const *) sectors, cluster.cnt * SLOT_SECTORS);
+	}
+	if (cluster.reserved > cluster.cnt)
+		bitmap_set_multiple (slot_map, cluster.first + cluster.cnt,
+				cluster.reserved - cluster.cnt, false);
+	cluster.reserved = cluster.cnt = 0;
+}
+
+/* Queues PAGE, whose contents are at KVA, in the cluster and
+ * returns its slot, or SWAP_NONE if swap is full.  When the run
+ * reserved for the cluster fills up, writes it and reserves
+ * another, as long a run as we can find up to SWAP_CLUSTER. */
+static size_t
+cluster_add (struct page *page, void *kva) {
+	size_t slot;
+
+	if (cluster.cnt == cluster.reserved) {
+		size_t want;
+
+		cluster_flush ();
+		for (want = SWAP_CLUSTER; want > 0; want /= 2) {
+			cluster.first = bitmap_scan_and_flip_next (slot_map, want, false);
+			if (cluster.first != BITMAP_ERROR) {
+				cluster.reserved = want;
+				break;
+			}
+		}
+		if (cluster.reserved == 0)
+			return SWAP_NONE;
+	}
+	slot = cluster.first + cluster.cnt;
+	cluster.kva[cluster.cnt++] = kva;
+	slot_page[slot] = page;
+	slot_refs[slot] = 1;
+	return slot;
+}
+
+/* Starts a cluster of pages to swap out.  Every anon_swap_out()
+ * until swap_cluster_end() only queues its page; the contents of
+ * those pages must not change before then. */
+void
+swap_cluster_begin (void) {
+	lock_acquire (&swap_lock);
+	ASSERT (cluster.cnt == 0 && cluster.reserved == 0);
+}
+
+/* Writes out the pages queued since swap_cluster_begin(). */
+void
+swap_cluster_end (void) {
+	cluster_flush ();
+	lock_release (&swap_lock);
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Returns true if SLOT holds the page of PAGE's process that lies
+ * as many pages away from PAGE as SLOT does from PAGE's slot, and
+ * only that page, which is not in memory. */
+static bool
+is_neighbour (const struct page *page, size_t slot) {
+	const struct page *other = slot_page[slot];
+	ptrdiff_t distance = (ptrdiff_t) slot - (ptrdiff_t) page->anon.slot;
+
+	return other != NULL && slot_refs[slot] == 1
+		&& other->owner == page->owner
+		&& other->frame == NULL
+		&& other->va == (uint8_t *) page->va + distance * PGSIZE;
+}
+
+/* Drops PAGE's reference to SLOT, freeing the slot with the last
+ * one.  Called with swap_lock held. */
+static void
+slot_put (size_t slot, const struct page *page) {
+	if (slot_page[slot] == page)
+		slot_page[slot] = NULL;
+	if (--slot_refs[slot] == 0)
+		bitmap_reset (slot_map, slot);
+}
+
+/* Swap in the page by read contents from the swap disk, or from
+ * the compressed pool if it is there.  A page that has never been
+ * swapped out is all zeros.
+ *
+ * Reads ahead the neighbours of PAGE found in the slots around its
+ * own, up to SWAP_CLUSTER pages in all, into frames that happen to
+ * be free; reading ahead never evicts.  A page advised MADV_RANDOM
+ * is read alone. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	/* Frames for slots SLOT - (SWAP_CLUSTER - 1)...SLOT +
+	 * (SWAP_CLUSTER - 1): the frame for slot S is FRAME(S). */
+	void *frames[2 * SWAP_CLUSTER - 1];
+#define FRAME(S) frames[SWAP_CLUSTER - 1 + (ptrdiff_t) (S) - (ptrdiff_t) slot]
+	size_t slot = anon_page->slot;
+	size_t max = page->advice == MADV_RANDOM ? 1 : SWAP_CLUSTER;
+	size_t lo, hi, s;
+
+	if (anon_page->zswap != ZSWAP_NONE) {
+		zswap_load (anon_page->zswap, kva);
+		zswap_free (anon_page->zswap);
+		anon_page->zswap = ZSWAP_NONE;
+		return true;
+	}
+	if (slot == SWAP_NONE) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+
+	lock_acquire (&swap_lock);
+	FRAME (slot) = kva;
+	for (hi = slot + 1; hi - slot < max
+			&& hi < bitmap_size (slot_map) && is_neighbour (page, hi); hi++)
+		if ((FRAME (hi) = palloc_get_page (PAL_USER)) == NULL)
+			break;
+	for (lo = slot; hi - lo < max
+			&& lo > 0 && is_neighbour (page, lo - 1); lo--)
+		if ((FRAME (lo - 1) = palloc_get_page (PAL_USER)) == NULL)
+			break;
+
+	set_sectors (&FRAME (lo), hi - lo);
+	disk_read_multiple (swap_disk, lo * SLOT_SECTORS, sectors,
+			(hi - lo) * SLOT_SECTORS);
+
+	for (s = lo; s < hi; s++) {
+		struct page *p = s == slot ? page : slot_page[s];
+
+		/* A neighbour we cannot map keeps its slot. */
+		if (s != slot && !vm_install_frame (p, FRAME (s)))
+			continue;
+		p->anon.slot = SWAP_NONE;
+		slot_put (s, p);
+	}
+	lock_release (&swap_lock);
+	return true;
+#undef FRAME
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by writing contents to the swap disk, unless
+ * it fits in the compressed pool.  Outside a cluster, the page forms
+ * a cluster of its own. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	bool alone = !lock_held_by_current_thread (&swap_lock);
+
+	anon_page->zswap = zswap_store (page->frame->kva);
+	if (anon_page->zswap != ZSWAP_NONE)
+		return true;
+	if (swap_disk == NULL)
+		return false;
+
+	if (alone)
+		swap_cluster_begin ();
+	anon_page->slot = cluster_add (page, page->frame->kva);
+	if (alone)
+		swap_cluster_end ();
+	return anon_page->slot != SWAP_NONE;
+}
+
+/* Makes PAGE, which shared its frame with SRC, refer to the copy
+ * of the frame that swap_out (SRC) has just made.  Inside a cluster
+ * the copy may not be written yet, but the slot is already SRC's. */
+void
+anon_swap_share (struct page *page, const struct page *src) {
+	bool alone = !lock_held_by_current_thread (&swap_lock);
+
+	ASSERT (page->anon.slot == SWAP_NONE && page->anon.zswap == ZSWAP_NONE);
+
+	page->anon.zswap = src->anon.zswap;
+	if (page->anon.zswap != ZSWAP_NONE)
+		zswap_dup (page->anon.zswap);
+	page->anon.slot = src->anon.slot;
+	if (page->anon.slot != SWAP_NONE) {
+		if (alone)
+			lock_acquire (&swap_lock);
+		slot_refs[page->anon.slot]++;
+		if (alone)
+			lock_release (&swap_lock);
+	}
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	/* After this the page cannot be on its way to swap. */
+	vm_free_frame (page);
+
+	if (anon_page->slot != SWAP_NONE) {
+		lock_acquire (&swap_lock);
+		slot_put (anon_page->slot, page);
+		lock_release (&swap_lock);
+	}
+	if (anon_page->zswap != ZSWAP_NONE)
+		zswap_free (anon_page->zswap);
 }
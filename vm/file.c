@@ -1,6 +1,13 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <syscall-nr.h>
+#include "devices/timer.h"
+#include "filesys/page_cache.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,9 +21,39 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Mapped files.
+ *
+ * A mapped page maps the frame of its page in the file's page cache
+ * (see filesys/page_cache.c), which the file's other mappings and
+ * read() and write() share, so nothing is copied.  Writes through a
+ * mapping are written back to the file from there. */
+
+/* Background writeback.
+ *
+ * FLUSHD, a kernel thread, wakes up every FLUSH_INTERVAL ticks and
+ * writes back the modified pages of every mapping on REGION_LIST, in
+ * the order of their offsets in the file, so that munmap, exit and
+ * eviction mostly find clean pages and have little left to write.
+ *
+ * A region is marked FLUSHING while flushd works on it, and
+ * unmap_region() waits for that to end before it removes the
+ * region's pages.  Flushd pins each page's frame while writing it,
+ * so that it is not evicted from under the write. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+static struct list region_list;
+static struct lock region_lock;         /* Protects REGION_LIST, FLUSHING. */
+static struct condition flush_done;
+
+static void flushd (void *aux);
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	list_init (&region_list);
+	lock_init (&region_lock);
+	cond_init (&flush_done);
+	thread_create ("flushd", PRI_DEFAULT, flushd, NULL);
 }
 
 /* Initialize the file backed page */
@@ -25,34 +62,320 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
-	struct file_page *file_page = &page->file;
+	struct file_page *file_page UNUSED = &page->file;
+	return true;
 }
 
-/* Swap in the page by read contents from the file. */
+/* Acquires the file system lock unless the current thread holds it
+ * already, as it does when a page fault or an eviction happens
+ * inside a file system call.  Returns true if it was acquired. */
 static bool
-file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+filesys_lock_acquire (void) {
+	if (lock_held_by_current_thread (&filesys_lock))
+		return false;
+	lock_acquire (&filesys_lock);
+	return true;
+}
+
+/* Writes PAGE, resident in a frame, back to its file if it was
+ * modified since it was last read or written, and marks it clean.
+ * The page is marked clean first, so that a write to it while it is
+ * being written back marks it dirty again.  The write goes straight
+ * to the file's sectors, without the file system lock, which the
+ * evictor may not take. */
+static void
+write_back (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+
+	if (pml4 == NULL || !pml4_is_dirty (pml4, page->va))
+		return;
+	pml4_set_dirty (pml4, page->va, false);
+	page_cache_write_back (page->file.cache, page->frame->kva);
+}
+
+/* Binds a mapped page to its part of the file and the file's cache
+ * page there, reading nothing.  AUX is the page's struct file_page. */
+static bool
+bind_file (struct page *page, void *aux) {
+	page->file = *(struct file_page *) aux;
+	free (aux);
+	page->file.cache = page_cache_get (file_get_inode (page->file.region->file),
+			page->file.ofs);
+	return page->file.cache != NULL;
+}
+
+/* A mapped page is never read into a frame of its own: it maps its
+ * cache page's frame instead, see claim_cache() in vm.c. */
+static bool
+file_backed_swap_in (struct page *page UNUSED, void *kva UNUSED) {
+	return false;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	write_back (page);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	if (page->frame != NULL)
+		write_back (page);
+	vm_free_frame (page);
+	if (page->file.cache != NULL)
+		page_cache_put (page->file.cache);
+}
+
+/* Removes PAGE from the table AUX. */
+static bool
+remove_page (struct page *page, void *aux) {
+	spt_remove_page (aux, page);
+	return true;
+}
+
+/* Returns the region whose area is VMA. */
+#define region_of(VMA)                                          \
+	((struct mmap_region *) ((uint8_t *) (VMA)              \
+		- offsetof (struct mmap_region, area)))
+
+/* Removes REGION and its pages from SPT, writing back the modified
+ * ones, and frees REGION. */
+static void
+unmap_region (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	struct vm_gather g;
+	bool locked;
+
+	if (region->file != NULL) {
+		lock_acquire (&region_lock);
+		while (region->flushing)
+			cond_wait (&flush_done, &region_lock);
+		list_remove (&region->elem);
+		lock_release (&region_lock);
+	}
+
+	vma_remove (spt, &region->area);
+	vm_gather_begin (spt, &g);
+	spt_for_each (spt, region->start,
+			(uint8_t *) region->start + region->page_cnt * PGSIZE,
+			remove_page, spt);
+	vm_gather_end (spt);
+	locked = filesys_lock_acquire ();
+	file_close (region->file);
+	if (locked)
+		lock_release (&filesys_lock);
+	free (region);
+}
+
+/* Binds PAGE, a page of a mapping made with MAP_POPULATE. */
+static bool
+bind_page (struct page *page, void *aux UNUSED) {
+	return swap_in (page, NULL);
+}
+
+/* Brings in the pages of REGION, which are bound to the file already,
+ * POPULATE_BATCH at a time with vm_map_cache(): the file's pages
+ * missing from its cache are read in with as few disk requests as
+ * the file's layout allows, then the whole batch is mapped at once.
+ * Stops early, leaving the rest to fault in as usual, if frames run
+ * out. */
+#define POPULATE_BATCH 16
+
+static void
+populate_region (struct mmap_region *region) {
+	struct supplemental_page_table *spt = &region->owner->spt;
+	struct page *pages[POPULATE_BATCH];
+	size_t done, cnt, i;
+
+	for (done = 0; done < region->page_cnt; done += cnt) {
+		uint8_t *va = (uint8_t *) region->start + done * PGSIZE;
+
+		cnt = region->page_cnt - done < POPULATE_BATCH
+			? region->page_cnt - done : POPULATE_BATCH;
+		for (i = 0; i < cnt; i++)
+			pages[i] = spt_find_page (spt, va + i * PGSIZE);
+		if (vm_map_cache (pages, cnt) < cnt)
+			return;
+	}
+}
+
+/* Brings in the pages of REGION, an anonymous mapping, for as long
+ * as there are free frames. */
+static void
+populate_anon (struct mmap_region *region) {
+	size_t i;
+
+	for (i = 0; i < region->page_cnt; i++)
+		if (palloc_below_wmark (WMARK_LOW)
+				|| !vm_claim_page ((uint8_t *) region->start + i * PGSIZE))
+			return;
 }
 
-/* Do the mmap */
+/* Do the mmap
+ *
+ * Maps LENGTH bytes of FILE from OFFSET at ADDR, which must be
+ * page-aligned, like OFFSET, and free for the whole length.  The
+ * part of the last page past the end of the file reads as zeros and
+ * is not written back.  If FILE is null, maps anonymous memory
+ * instead, which reads as zeros and ignores OFFSET.  Pages are
+ * loaded on first touch, unless MAP_POPULATE is or'ed into WRITABLE,
+ * in which case as many as memory allows are loaded and mapped right
+ * away.  Returns ADDR, or NULL on failure. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = (uint8_t *) addr + length;
+	bool populate = (writable & MAP_POPULATE) != 0;
+	struct mmap_region *region;
+	off_t file_len;
+	size_t i;
+
+	writable &= ~MAP_POPULATE;
+	if (addr == NULL || pg_ofs (addr) != 0 || offset < 0
+			|| offset % PGSIZE != 0 || length == 0
+			|| end < (uint8_t *) addr || !is_user_vaddr (end - 1)
+			|| vma_find (spt, addr, pg_round_up (end)) != NULL)
+		return NULL;
+
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	region->file = NULL;
+	if (file != NULL) {
+		lock_acquire (&filesys_lock);
+		region->file = file_reopen (file);
+		file_len = region->file != NULL ? file_length (region->file) : 0;
+		lock_release (&filesys_lock);
+		if (file_len == 0) {
+			file_close (region->file);
+			free (region);
+			return NULL;
+		}
+	}
+	region->start = addr;
+	region->page_cnt = (size_t) ((uint8_t *) pg_round_up (end)
+			- (uint8_t *) addr) >> PGBITS;
+	vma_insert (spt, &region->area, addr, pg_round_up (end), VMA_MMAP);
+	region->owner = thread_current ();
+	region->flushing = false;
+	if (file == NULL) {
+		for (i = 0; i < region->page_cnt; i++)
+			if (!vm_alloc_page (VM_ANON, (uint8_t *) addr + i * PGSIZE,
+						writable))
+				goto fail;
+		if (populate)
+			populate_anon (region);
+		return addr;
+	}
+	lock_acquire (&region_lock);
+	list_push_back (&region_list, &region->elem);
+	lock_release (&region_lock);
+
+	for (i = 0; i < region->page_cnt; i++) {
+		struct file_page *aux = malloc (sizeof *aux);
+
+		if (aux == NULL)
+			goto fail;
+		aux->region = region;
+		aux->ofs = offset + (off_t) (i * PGSIZE);
+		if (!vm_alloc_page_with_initializer (VM_FILE,
+					(uint8_t *) addr + i * PGSIZE, writable,
+					bind_file, aux)) {
+			free (aux);
+			goto fail;
+		}
+	}
+
+	/* A populated mapping's pages read nothing on their first fault,
+	 * so all of them must be bound before any is brought in. */
+	if (populate) {
+		if (!spt_for_each (spt, addr, end, bind_page, NULL))
+			goto fail;
+		populate_region (region);
+	}
+	return addr;
+
+fail:
+	unmap_region (spt, region);
+	return NULL;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_area *vma = vma_find (spt, addr, (uint8_t *) addr + 1);
+
+	if (vma != NULL && vma->kind == VMA_MMAP && vma_start (vma) == addr)
+		unmap_region (spt, region_of (vma));
+}
+
+/* Unmaps every region in SPT. */
+void
+do_munmap_all (struct supplemental_page_table *spt) {
+	struct vm_area *vma, *next;
+
+	for (vma = vma_find (spt, NULL, (void *) KERN_BASE); vma != NULL;
+			vma = next) {
+		next = vma_next (vma, NULL, (void *) KERN_BASE);
+		if (vma->kind == VMA_MMAP)
+			unmap_region (spt, region_of (vma));
+	}
+}
+
+/* Writes PAGE back if it is resident and modified. */
+static bool
+flush_page (struct page *page, void *aux UNUSED) {
+	struct frame *frame;
+
+	/* Pages not yet loaded are still uninit, and clean. */
+	if (VM_TYPE (page->operations->type) != VM_FILE)
+		return true;
+	frame = vm_pin_frame (page);
+	if (frame != NULL) {
+		write_back (page);
+		vm_unpin_frame (frame);
+	}
+	return true;
+}
+
+/* Returns the first region on REGION_LIST after PREV, or the first
+ * one of all if PREV is null, marked FLUSHING, or NULL if there are
+ * no more.  Clears PREV's FLUSHING.  A region stays on the list while
+ * it is flushing, so the walk can go on from it. */
+static struct mmap_region *
+next_region (struct mmap_region *prev) {
+	struct mmap_region *region = NULL;
+	struct list_elem *e;
+
+	lock_acquire (&region_lock);
+	e = prev != NULL ? list_next (&prev->elem) : list_begin (&region_list);
+	if (e != list_end (&region_list)) {
+		region = list_entry (e, struct mmap_region, elem);
+		region->flushing = true;
+	}
+	if (prev != NULL) {
+		prev->flushing = false;
+		cond_broadcast (&flush_done, &region_lock);
+	}
+	lock_release (&region_lock);
+	return region;
+}
+
+/* Kernel thread that writes back modified mapped pages. */
+static void
+flushd (void *aux UNUSED) {
+	for (;;) {
+		struct mmap_region *region;
+
+		timer_sleep (FLUSH_INTERVAL);
+		for (region = next_region (NULL); region != NULL;
+				region = next_region (region))
+			spt_for_each (&region->owner->spt, region->start,
+					(uint8_t *) region->start + region->page_cnt * PGSIZE,
+					flush_page, NULL);
+	}
 }
@@ -0,0 +1,154 @@
+/* text.c: Program text shared between processes. */
+
+#include "vm/text.h"
+#include <debug.h>
+#include "filesys/inode.h"
+#include "filesys/page_cache.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/syscall.h"
+#include "vm/vm.h"
+
+/* Shared text.
+ *
+ * The read-only segments of an executable are the same in every
+ * process running it, so instead of loading private copies, a text
+ * page maps the frame of its page in the executable's page cache
+ * (see filesys/page_cache.c), read-only, the way a mapped file page
+ * does.  The first process to touch a page of text reads it into the
+ * cache; every other process, and read() of the executable, finds it
+ * there, and the frame's REF_CNT counts the mappings.  Since a cache
+ * page covers a whole page of the file, load_segment() only makes
+ * text of pages whose data runs to the end of the page or of the
+ * file.
+ *
+ * A text page holds its inode open, so that the text outlives the
+ * process that loaded the executable while a child of it still runs
+ * the text.  The cache, and the text in it, goes when the inode is
+ * closed for the last time. */
+
+static bool text_swap_in (struct page *page, void *kva);
+static bool text_swap_out (struct page *page);
+static void text_destroy (struct page *page);
+
+static const struct page_operations text_ops = {
+	.swap_in = text_swap_in,
+	.swap_out = text_swap_out,
+	.destroy = text_destroy,
+	.type = VM_FILE | VM_TEXT,
+};
+
+/* Key of a text page, the AUX of a text page not touched yet. */
+struct text_key {
+	struct inode *inode;
+	off_t ofs;
+};
+
+/* Sets up a text page. */
+bool
+text_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
+	page->operations = &text_ops;
+	page->file.region = NULL;
+	page->file.cache = NULL;
+	return true;
+}
+
+/* Binds PAGE to the cache page for AUX, a struct text_key, on its
+ * first fault, and opens the inode again for PAGE.  Nothing is read
+ * here; see claim_cache() in vm.c. */
+static bool
+text_bind (struct page *page, void *aux) {
+	struct text_key *key = aux;
+
+	page->file.ofs = key->ofs;
+	page->file.cache = page_cache_get (key->inode, key->ofs);
+	if (page->file.cache != NULL)
+		inode_reopen (key->inode);
+	free (key);
+	return page->file.cache != NULL;
+}
+
+/* Adds a page of shared text at UPAGE to the current process: the
+ * page of INODE at OFS, which must be page-aligned. */
+bool
+text_alloc_page (void *upage, struct inode *inode, off_t ofs) {
+	struct text_key *key = malloc (sizeof *key);
+
+	if (key == NULL)
+		return false;
+	key->inode = inode;
+	key->ofs = ofs;
+	if (!vm_alloc_page_with_initializer (VM_FILE | VM_TEXT, upage, false,
+				text_bind, key)) {
+		free (key);
+		return false;
+	}
+	return true;
+}
+
+/* Gives the current process a page of the same text as SRC, at
+ * the same address, for fork.  The child maps the shared frame on
+ * its first touch.
+ *
+ * The inode in a text page's key is only kept open by the process
+ * running the executable, which the child is not, so both pages are
+ * bound to their cache page right away. */
+bool
+text_copy_page (struct page *src) {
+	struct cache_page *cp;
+	struct page *page;
+
+	/* Binding an uninit text page reads nothing into KVA. */
+	if (VM_TYPE (src->operations->type) == VM_UNINIT
+			&& !swap_in (src, NULL))
+		return false;
+	cp = src->file.cache;
+	if (cp == NULL || !text_alloc_page (src->va, cp->inode, cp->ofs))
+		return false;
+	page = spt_find_page (&thread_current ()->spt, src->va);
+	return page != NULL && swap_in (page, NULL);
+}
+
+/* Returns true if PAGE is a page of shared text. */
+bool
+page_is_text (const struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return (page->uninit.type & VM_TEXT) != 0;
+	return page->operations == &text_ops;
+}
+
+/* Text is never read into a frame of its own: it maps its cache
+ * page's frame instead. */
+static bool
+text_swap_in (struct page *page UNUSED, void *kva UNUSED) {
+	return false;
+}
+
+/* Text is never modified, so there is nothing to write. */
+static bool
+text_swap_out (struct page *page UNUSED) {
+	return true;
+}
+
+/* Unmaps PAGE and drops its references to its cache page and its
+ * inode. */
+static void
+text_destroy (struct page *page) {
+	struct cache_page *cp = page->file.cache;
+	struct inode *inode;
+	bool locked;
+
+	vm_free_frame (page);
+	if (cp == NULL)
+		return;
+	inode = cp->inode;
+	page_cache_put (cp);
+
+	locked = !lock_held_by_current_thread (&filesys_lock);
+	if (locked)
+		lock_acquire (&filesys_lock);
+	inode_close (inode);
+	if (locked)
+		lock_release (&filesys_lock);
+}
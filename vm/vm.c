@@ -1,21 +1,95 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
 #include "threads/malloc.h"
+#include <string.h>
+#include <syscall-nr.h>
+#include "devices/timer.h"
+#include "filesys/page_cache.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
 
+/* Frame table.
+ *
+ * Every frame holding a user page is on FRAME_LIST.  When the user
+ * pool runs dry, vm_evict_frame() picks a victim with a clock hand
+ * sweeping that list, using the accessed and dirty bits of the
+ * owner's page table.  A frame is skipped while its pin count is
+ * nonzero: a fresh frame stays pinned until its contents are in, and
+ * system calls pin the user buffers they hand to the disk.
+ *
+ * During eviction the victim's page is unmapped but keeps its frame,
+ * marked EVICTING, until the contents are safely out.  Anyone who
+ * needs that page meanwhile waits on EVICT_DONE.
+ *
+ * After fork, parent and child share their anonymous frames
+ * read-only, and REF_CNT counts the pages mapping a frame.  The
+ * first write to such a page copies it (vm_handle_wp()).  FRAME's
+ * PAGE is only one of the sharers, or null once that one is gone,
+ * so shared frames are not evicted.
+ *
+ * The frames of the page cache (see filesys/page_cache.c) are in the
+ * table too, with CACHE set.  Every mapping of a cached file page,
+ * and every process running an executable whose text it holds (see
+ * text.c), maps its frame, writable if the mapping is, REF_CNT of
+ * them, and the frame stays cached once none does; see "Page cache
+ * frames" below.
+ *
+ * ZERO_FRAME is a page of zeros that every anonymous page which has
+ * never been written maps on a read fault, copy-on-write.  It is
+ * not on FRAME_LIST, and its REF_CNT counts one extra reference so
+ * that it is never freed.
+ *
+ * Anonymous frames with the same contents are also merged into one
+ * shared frame in the background; see ksmd() below.
+ *
+ * Frames are normally reclaimed ahead of need by kswapd(), and each
+ * process's resident set may be capped by RSS_LIMIT; see "Reclaim"
+ * below. */
+static struct list frame_list;
+static size_t frame_cnt;
+static struct list_elem *clock_hand;
+static struct list_elem *ksm_cursor;    /* Where ksmd() scans next. */
+static struct lock frame_lock;          /* Protects all of the above. */
+static struct condition evict_done;
+static struct frame zero_frame;
+
+/* -rss=COUNT: Most pages resident in any one process, or 0 for no
+ * limit. */
+size_t rss_limit;
+
+static void ksm_init (void);
+static void ksm_forget (struct frame *);
+static void kswapd_init (void);
+static void kswapd_wake (void);
+
+/* Initializes the frame table.  Called before the file system is
+ * initialized, since the page cache keeps its pages in frames, and
+ * before vm_init(). */
+void
+vm_frame_init (void) {
+	list_init (&frame_list);
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+}
+
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
 void
 vm_init (void) {
 	vm_anon_init ();
 	vm_file_init ();
-#ifdef EFILESYS  /* For project 4 */
-	pagecache_init ();
-#endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	zero_frame.kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	zero_frame.ref_cnt = 1;
+	ksm_init ();
+	kswapd_init ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +107,11 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct thread *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (struct thread *owner);
+static void page_set_frame (struct page *, struct frame *);
+static struct frame *frame_for (struct page *);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -50,94 +126,921 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = type & VM_TEXT ? text_initializer
+					: file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->writable = writable;
+		page->owner = thread_current ();
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
+/* Supplemental page table.
+ *
+ * A radix tree whose four levels mirror the x86-64 page table.  A
+ * node at every level is one page of SPT_SLOTS pointers, indexed by
+ * the same nine bits of the address that the MMU uses at that level,
+ * and the slots of the last level point to struct pages.  A lookup is
+ * thus four dependent loads, the pages of a 2 MB region sit densely in
+ * one leaf, and spt_for_each() skips whole empty subtrees on its way
+ * through a range.  Nodes are only freed when the table is killed. */
+
+#define SPT_LEVELS 4
+#define SPT_SLOTS (PGSIZE / sizeof (void *))
+
+/* Shift of the index bits for each level, top first. */
+static const unsigned spt_shift[SPT_LEVELS] = {
+	PML4SHIFT, PDPESHIFT, PDXSHIFT, PTXSHIFT
+};
+
+/* Returns the slot for VA's page in SPT, or NULL if the path to it
+ * does not exist.  If CREATE, allocates missing nodes instead, and
+ * returns NULL only if out of memory. */
+static struct page **
+spt_slot (struct supplemental_page_table *spt, const void *va, bool create) {
+	void **slot = (void **) &spt->root;
+	int level;
+
+	for (level = 0; level < SPT_LEVELS; level++) {
+		void **node = *slot;
+
+		if (node == NULL) {
+			if (!create || (node = palloc_get_page (PAL_ZERO)) == NULL)
+				return NULL;
+			*slot = node;
+		}
+		slot = &node[((uint64_t) va >> spt_shift[level]) % SPT_SLOTS];
+	}
+	return (struct page **) slot;
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page **slot = spt_slot (spt, pg_round_down (va), false);
 
-	return page;
+	return slot != NULL ? *slot : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page **slot;
 
-	return succ;
+	if (pg_ofs (page->va) != 0 || !is_user_vaddr (page->va))
+		return false;
+
+	slot = spt_slot (spt, page->va, true);
+	if (slot == NULL || *slot != NULL)
+		return false;
+	*slot = page;
+	spt->page_cnt++;
+	return true;
 }
 
+/* Removes PAGE from SPT and frees it. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	struct page **slot = spt_slot (spt, page->va, false);
+
+	ASSERT (slot != NULL && *slot == page);
+	*slot = NULL;
+	spt->page_cnt--;
 	vm_dealloc_page (page);
+}
+
+/* Calls ACTION for the pages of NODE, a node at LEVEL covering
+ * addresses from BASE, that lie in [START, END), in address order. */
+static bool
+spt_walk (void **node, int level, uint64_t base, uint64_t start,
+		uint64_t end, spt_action_func *action, void *aux) {
+	unsigned shift = spt_shift[level];
+	size_t i = start > base ? (start - base) >> shift : 0;
+
+	for (; i < SPT_SLOTS; i++) {
+		uint64_t lo = base + ((uint64_t) i << shift);
+		void *child = node[i];
+
+		if (lo >= end)
+			break;
+		if (child == NULL)
+			continue;
+		if (level == SPT_LEVELS - 1) {
+			if (!action (child, aux))
+				return false;
+		} else if (!spt_walk (child, level + 1, lo, start, end, action, aux))
+			return false;
+	}
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Calls ACTION with AUX for every page in SPT whose address is in
+ * [START, END), in address order, stopping early if ACTION returns
+ * false.  ACTION may remove the page it is given.  Returns false if
+ * the walk was stopped, true otherwise. */
+bool
+spt_for_each (struct supplemental_page_table *spt, void *start, void *end,
+		spt_action_func *action, void *aux) {
+	if (spt->root == NULL)
+		return true;
+	return spt_walk (spt->root, 0, 0, (uint64_t) start, (uint64_t) end,
+			action, aux);
+}
+
+/* Frees NODE at LEVEL, along with everything below it. */
+static void
+spt_destroy (void **node, int level) {
+	size_t i;
+
+	for (i = 0; i < SPT_SLOTS; i++)
+		if (node[i] != NULL) {
+			if (level == SPT_LEVELS - 1)
+				vm_dealloc_page (node[i]);
+			else
+				spt_destroy (node[i], level + 1);
+		}
+	palloc_free_page (node);
+}
+
+/* Virtual memory areas.
+ *
+ * Besides its pages, a table records the ranges of the address space
+ * in which the process may have pages at all: the segments of its
+ * executable, the STACK_LIMIT bytes below USER_STACK, and each region
+ * it has mapped with mmap().  These areas are kept in VMAS, an
+ * interval tree, so that finding the area that holds an address, or
+ * one that overlaps a range, takes time logarithmic in the number of
+ * areas.  mmap() checks new regions for overlap against them,
+ * munmap() finds its region among them, and a fault on an address
+ * with no page is taken for stack growth only within the stack's
+ * area. */
+
+/* Adds VMA, the range from START to END, of type KIND, to SPT. */
+void
+vma_insert (struct supplemental_page_table *spt, struct vm_area *vma,
+		void *start, void *end, enum vma_kind kind) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+
+	vma->kind = kind;
+	interval_insert (&spt->vmas, &vma->elem, (uint64_t) start,
+			(uint64_t) end);
+}
+
+/* Allocates an area from START to END, of type KIND, and adds it to
+ * SPT.  Returns false if out of memory. */
+bool
+vma_add (struct supplemental_page_table *spt, void *start, void *end,
+		enum vma_kind kind) {
+	struct vm_area *vma = malloc (sizeof *vma);
+
+	if (vma == NULL)
+		return false;
+	vma_insert (spt, vma, start, end, kind);
+	return true;
+}
+
+/* Removes VMA from SPT. */
+void
+vma_remove (struct supplemental_page_table *spt, struct vm_area *vma) {
+	interval_remove (&spt->vmas, &vma->elem);
+}
+
+/* Returns the lowest area in SPT that overlaps START to END, or
+ * NULL if there is none. */
+struct vm_area *
+vma_find (struct supplemental_page_table *spt, const void *start,
+		const void *end) {
+	struct interval_elem *e = interval_first (&spt->vmas, (uint64_t) start,
+			(uint64_t) end);
+
+	return e != NULL ? interval_entry (e, struct vm_area, elem) : NULL;
+}
+
+/* Returns the next area after VMA that overlaps START to END, or
+ * NULL if there is none. */
+struct vm_area *
+vma_next (struct vm_area *vma, const void *start, const void *end) {
+	struct interval_elem *e = interval_next (&vma->elem, (uint64_t) start,
+			(uint64_t) end);
+
+	return e != NULL ? interval_entry (e, struct vm_area, elem) : NULL;
+}
+
+/* Returns the frame under the clock hand and advances the hand. */
 static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+clock_next (void) {
+	struct list_elem *e = clock_hand;
+
+	if (e == NULL || e == list_end (&frame_list))
+		e = list_begin (&frame_list);
+	clock_hand = list_next (e);
+	return list_entry (e, struct frame, elem);
+}
 
-	return victim;
+/* Returns true if any page mapping FRAME has been accessed since
+ * its accessed bit was last cleared, or, for a frame of the page
+ * cache, if read() or write() used it since then. */
+static bool
+frame_is_accessed (struct frame *frame) {
+	struct page *page;
+
+	if (frame->cache != NULL && frame->cache->accessed)
+		return true;
+	for (page = frame->page; page != NULL; page = page->rmap_next)
+		if (pml4_is_accessed (page->owner->pml4, page->va))
+			return true;
+	return false;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Clears the accessed bits of all the pages mapping FRAME. */
+static void
+frame_clear_accessed (struct frame *frame) {
+	struct page *page;
+
+	if (frame->cache != NULL)
+		frame->cache->accessed = false;
+	for (page = frame->page; page != NULL; page = page->rmap_next)
+		pml4_set_accessed (page->owner->pml4, page->va, false);
+}
+
+/* Returns true if any page mapping FRAME has written to it. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct page *page;
+
+	for (page = frame->page; page != NULL; page = page->rmap_next)
+		if (pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	return false;
+}
+
+/* Get the struct frame, that will be evicted.
+ *
+ * This is the enhanced second-chance clock: the even sweeps look for
+ * a frame that is neither accessed nor dirty, touching nothing; the
+ * odd sweeps settle for one that is not accessed, and clear the
+ * accessed bits they pass over.  A frame shared by several pages
+ * counts as accessed or dirty if any of them is.  Four sweeps are
+ * always enough unless every frame is pinned.  An idle frame of the
+ * page cache, which no page maps, still gets its second chance.  The
+ * frame of a page advised MADV_DONTNEED that has not been touched
+ * since is taken as soon as the hand reaches it; a page advised
+ * MADV_SEQUENTIAL gets no second chance.  Advice is only heeded for
+ * a frame of one page.  If OWNER is nonnull, only a frame
+ * of OWNER's alone will do.  Called with frame_lock held. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+vm_get_victim (struct thread *owner) {
+	int sweep;
+	size_t i;
 
+	for (sweep = 0; sweep < 4; sweep++)
+		for (i = 0; i < frame_cnt; i++) {
+			struct frame *frame = clock_next ();
+			int advice;
+
+			if (frame->pin_cnt > 0 || frame->evicting)
+				continue;
+			if (owner != NULL && (frame->ref_cnt != 1
+						|| frame->page->owner != owner))
+				continue;
+			advice = frame->ref_cnt == 1 ? frame->page->advice : MADV_NORMAL;
+			if (advice == MADV_DONTNEED) {
+				if (!frame_is_accessed (frame))
+					return frame;
+				frame->page->advice = advice = MADV_NORMAL;
+			}
+			if (frame_is_accessed (frame) && advice != MADV_SEQUENTIAL) {
+				if (sweep % 2 == 1)
+					frame_clear_accessed (frame);
+			} else if (sweep % 2 == 1 || !frame_is_dirty (frame))
+				return frame;
+		}
 	return NULL;
 }
 
+/* Removes FRAME from the frame table.  Called with frame_lock
+ * held. */
+static void
+frame_unlink (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	if (ksm_cursor == &frame->elem)
+		ksm_cursor = list_next (ksm_cursor);
+	ksm_forget (frame);
+	list_remove (&frame->elem);
+	frame_cnt--;
+}
+
+/* Evict one page and return the corresponding frame, pinned and
+ * mapped by no page.  Return NULL on error.
+ *
+ * Evicts a batch of up to SWAP_CLUSTER victims at once, so that
+ * their anonymous pages go to swap as one cluster, and returns the
+ * frames beyond the first to the user pool.  If OWNER is nonnull,
+ * evicts a single page of OWNER's instead. */
+static struct frame *
+vm_evict_frame (struct thread *owner) {
+	struct frame *victims[SWAP_CLUSTER];
+	bool ok[SWAP_CLUSTER];
+	struct frame *result = NULL;
+	struct tlb_gather tlb;
+	enum intr_level old_level;
+	size_t max = owner != NULL ? 1 : SWAP_CLUSTER;
+	size_t cnt = 0, spare_cnt = 0, i;
+
+	lock_acquire (&frame_lock);
+	while (cnt < max) {
+		struct frame *victim = vm_get_victim (owner);
+
+		if (victim == NULL)
+			break;
+		victim->evicting = true;
+		victims[cnt++] = victim;
+	}
+	lock_release (&frame_lock);
+	if (cnt == 0)
+		return NULL;
+
+	/* Unmap every page mapping a victim first, so that the owners
+	 * cannot change the pages while they are written out.  The dirty
+	 * bits survive in the PTEs.  An idle frame of the page cache has
+	 * no page.  The TLB is flushed once for each run of
+	 * mappings in the same address space, with interrupts off so that
+	 * no owner runs on a stale entry. */
+	tlb_gather_init (&tlb, NULL);
+	old_level = intr_disable ();
+	for (i = 0; i < cnt; i++) {
+		struct page *page;
+
+		ok[i] = true;
+		for (page = victims[i]->page; page != NULL; page = page->rmap_next) {
+			if (page->owner->pml4 != tlb.pml4) {
+				tlb_gather_finish (&tlb);
+				tlb_gather_init (&tlb, page->owner->pml4);
+			}
+			tlb_gather_clear_page (&tlb, page->va);
+		}
+	}
+	tlb_gather_finish (&tlb);
+	intr_set_level (old_level);
+
+	/* Other pages may take locks of their own to write themselves
+	 * out, so they must not do it inside the swap cluster.  A frame of
+	 * the page cache is written back to its file if any page mapping
+	 * it wrote to it.  Otherwise only anonymous frames are shared; the
+	 * first page of a shared anonymous frame writes it
+	 * out, and the others take references to its copy. */
+	for (i = 0; i < cnt; i++) {
+		struct frame *victim = victims[i];
+
+		if (victim->cache != NULL) {
+			if (frame_is_dirty (victim))
+				page_cache_write_back (victim->cache, victim->kva);
+		} else if (victim->page != NULL
+				&& VM_TYPE (victim->page->operations->type) != VM_ANON)
+			ok[i] = swap_out (victim->page);
+	}
+	swap_cluster_begin ();
+	for (i = 0; i < cnt; i++) {
+		struct page *page = victims[i]->page;
+		struct page *other;
+
+		if (page == NULL || VM_TYPE (page->operations->type) != VM_ANON)
+			continue;
+		ok[i] = swap_out (page);
+		if (ok[i])
+			for (other = page->rmap_next; other != NULL;
+					other = other->rmap_next)
+				anon_swap_share (other, page);
+	}
+	swap_cluster_end ();
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		struct frame *victim = victims[i];
+		struct page *page = victim->page;
+
+		victim->evicting = false;
+		if (!ok[i]) {
+			/* Map it back, read-only still if it is shared. */
+			for (; page != NULL; page = page->rmap_next) {
+				uint64_t *pml4 = page->owner->pml4;
+				bool dirty = pml4_is_dirty (pml4, page->va);
+
+				pml4_set_page (pml4, page->va, victim->kva,
+						page->writable && victim->ref_cnt == 1);
+				pml4_set_dirty (pml4, page->va, dirty);
+			}
+			continue;
+		}
+		while ((page = victim->page) != NULL) {
+			victim->page = page->rmap_next;
+			page->rmap_next = NULL;
+			page_set_frame (page, NULL);
+		}
+		victim->ref_cnt = 0;
+		if (victim->cache != NULL) {
+			/* The frame's reference to its cache page goes with it. */
+			victim->cache->frame = NULL;
+			page_cache_put (victim->cache);
+			victim->cache = NULL;
+		}
+		if (result == NULL) {
+			result = victim;
+			result->pin_cnt = 1;
+			ksm_forget (result);
+		} else {
+			frame_unlink (victim);
+			victims[spare_cnt++] = victim;
+		}
+	}
+	cond_broadcast (&evict_done, &frame_lock);
+	lock_release (&frame_lock);
+
+	for (i = 0; i < spare_cnt; i++) {
+		palloc_free_page (victims[i]->kva);
+		free (victims[i]);
+	}
+	return result;
+}
+
 /* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * and return it.  The frame comes back pinned, for the caller to link
+ * pages to with rmap_add().  Returns NULL only if the user pool is
+ * full and no page can be evicted. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame;
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (palloc_below_wmark (WMARK_LOW))
+		kswapd_wake ();
+	if (kva == NULL)
+		return vm_evict_frame (NULL);
+
+	frame = malloc (sizeof *frame);
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	frame->cache = NULL;
+	frame->ref_cnt = 0;
+	frame->pin_cnt = 1;
+	frame->evicting = false;
+	frame->checksum = 0;
+	frame->ksm_listed = false;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_list, &frame->elem);
+	frame_cnt++;
+	lock_release (&frame_lock);
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
+/* Sets PAGE's frame to FRAME, which may be null, and counts the
+ * change in the resident set of PAGE's owner. */
+static void
+page_set_frame (struct page *page, struct frame *frame) {
+	size_t *rss = &page->owner->spt.rss;
+
+	if (page->frame == NULL && frame != NULL)
+		__atomic_fetch_add (rss, 1, __ATOMIC_RELAXED);
+	else if (page->frame != NULL && frame == NULL)
+		__atomic_fetch_sub (rss, 1, __ATOMIC_RELAXED);
+	page->frame = frame;
+}
+
+/* Reverse mapping.
+ *
+ * Eviction has to unmap a frame from every page that maps it, and
+ * those may belong to many processes once fork() and ksmd share
+ * anonymous frames, or processes map the page cache.  So each frame keeps the
+ * pages mapping it on a chain, headed by its PAGE member and linked
+ * through the pages' RMAP_NEXT, with REF_CNT its length.  The zero
+ * frame is mapped by too many pages to be worth chaining, and is
+ * never evicted, so it only counts them. */
+
+/* Adds PAGE to the pages mapping FRAME, and makes FRAME its frame.
+ * Called with frame_lock held. */
+static void
+rmap_add (struct frame *frame, struct page *page) {
+	frame->ref_cnt++;
+	if (frame != &zero_frame) {
+		page->rmap_next = frame->page;
+		frame->page = page;
+	}
+	page_set_frame (page, frame);
+}
+
+/* Removes PAGE, which maps FRAME, from the pages mapping it, and
+ * leaves it without a frame.  Returns true if no page maps FRAME any
+ * more.  Called with frame_lock held. */
+static bool
+rmap_del (struct frame *frame, struct page *page) {
+	struct page **p;
+
+	if (frame != &zero_frame) {
+		for (p = &frame->page; *p != page; p = &(*p)->rmap_next)
+			ASSERT (*p != NULL);
+		*p = page->rmap_next;
+		page->rmap_next = NULL;
+	}
+	page_set_frame (page, NULL);
+	return --frame->ref_cnt == 0;
+}
+
+/* Gets a frame for PAGE, pinned, like vm_get_frame().  If PAGE's
+ * owner is at its resident set limit, takes the frame of one of the
+ * owner's other pages instead. */
+static struct frame *
+frame_for (struct page *page) {
+	struct thread *owner = page->owner;
+	struct frame *frame = NULL;
+
+	if (rss_limit > 0 && owner->spt.rss >= rss_limit)
+		frame = vm_evict_frame (owner);
+	return frame != NULL ? frame : vm_get_frame ();
+}
+
+/* Waits until PAGE is not being evicted.  Called with frame_lock
+ * held. */
+static void
+wait_for_eviction (struct page *page) {
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+}
+
+/* Returns true if ADDR, in the stack's area, may be a stack access by
+ * a process whose stack pointer is RSP: no lower than a push could
+ * touch. */
+static bool
+is_stack_access (const void *addr, const void *rsp) {
+	return rsp != NULL && (const uint8_t *) addr >= (uint8_t *) rsp - 8;
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON | VM_STACK, pg_round_down (addr), true);
+}
+
+/* Returns true if PAGE is writable but mapped read-only because it
+ * shares its frame. */
+static bool
+is_cow (struct page *page) {
+	uint64_t *pte = pml4e_walk (page->owner->pml4, (uint64_t) page->va, 0);
+
+	return page->writable && pte != NULL && (*pte & PTE_P) != 0
+		&& !is_writable (pte);
+}
+
+/* Handle the fault on write_protected page
+ *
+ * PAGE is writable but shares its frame: gives it a private copy of
+ * the frame, or the frame itself if the other sharers are gone, and
+ * maps it writable. */
+static bool
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	struct frame *old, *new;
+	bool free_old;
+
+	lock_acquire (&frame_lock);
+	wait_for_eviction (page);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted meanwhile; the next access faults it back in,
+		 * writable. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old->ref_cnt == 1) {
+		lock_release (&frame_lock);
+		return pml4_set_page (pml4, page->va, old->kva, true);
+	}
+	old->pin_cnt++;
+	lock_release (&frame_lock);
+
+	new = frame_for (page);
+	if (new != NULL) {
+		if (old == &zero_frame)
+			memset (new->kva, 0, PGSIZE);
+		else
+			memcpy (new->kva, old->kva, PGSIZE);
+	}
+
+	lock_acquire (&frame_lock);
+	old->pin_cnt--;
+	free_old = false;
+	if (new != NULL) {
+		free_old = rmap_del (old, page);
+		if (free_old)
+			frame_unlink (old);
+		rmap_add (new, page);
+	}
+	lock_release (&frame_lock);
+	if (new == NULL)
+		return false;
+
+	/* This replaces the read-only mapping of OLD and flushes it from
+	 * the TLB. */
+	pml4_set_page (pml4, page->va, new->kva, true);
+	if (free_old) {
+		palloc_free_page (old->kva);
+		free (old);
+	}
+	lock_acquire (&frame_lock);
+	new->pin_cnt--;
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Returns true if PAGE is an anonymous page that has never been
+ * written: one with nothing to load it from, not in memory and not
+ * in swap. */
+static bool
+is_untouched (struct page *page) {
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			return page->uninit.init == NULL
+				&& VM_TYPE (page->uninit.type) == VM_ANON;
+		case VM_ANON:
+			return page->frame == NULL && page->anon.slot == SWAP_NONE
+				&& page->anon.zswap == ZSWAP_NONE;
+		default:
+			return false;
+	}
+}
+
+/* Maps the zero frame read-only at PAGE, which must be untouched.
+ * The first write to PAGE will give it a frame of its own. */
+static bool
+map_zero_page (struct page *page) {
+	/* An uninit page is only turned into an anonymous page here.
+	 * It has no initializer, so nothing is written to the frame. */
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !swap_in (page, zero_frame.kva))
+		return false;
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_frame.kva, false))
+		return false;
+
+	lock_acquire (&frame_lock);
+	rmap_add (&zero_frame, page);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Fault-around.
+ *
+ * A fault that has to read its page from a file (an ELF segment or a
+ * mapped file) also brings in the pages that follow, up to the
+ * address space's FA_WINDOW in all, stopping at the first page that
+ * is already resident or not read from a file.  The window doubles,
+ * up to FAULT_AROUND_MAX, each time a fault lands right where the
+ * last one's window ended, and falls back to a single page when one
+ * does not.  A page advised MADV_SEQUENTIAL gets the largest window
+ * at once, and one advised MADV_RANDOM no fault-around at all.
+ * Fault-around only uses frames that are free for the taking: the
+ * window shrinks to the faulting page once free memory runs low,
+ * rather than evict. */
+#define FAULT_AROUND_MAX 16
+
+/* Returns true if PAGE is not resident and must be read from a
+ * file to bring it in. */
+static bool
+is_file_backed (struct page *page) {
+	if (page->frame != NULL)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.init != NULL;
+	return VM_TYPE (page->operations->type) == VM_FILE;
+}
+
+static size_t cache_run (struct page *pages[], size_t cnt);
+
+/* Brings in PAGE, which faulted and must be read from a file, and
+ * the pages after it in the current process's SPT, and adjusts the
+ * window.  Runs of pages of mapped files and of text are read into
+ * the page cache together and mapped with vm_map_cache().  Returns false if PAGE
+ * itself could not be brought in. */
+static bool
+fault_around (struct supplemental_page_table *spt, struct page *page) {
+	struct page *pages[FAULT_AROUND_MAX];
+	uint8_t *va = page->va;
+	size_t cnt, i;
+
+	if (page->advice == MADV_RANDOM)
+		spt->fa_window = 1;
+	else if (page->advice == MADV_SEQUENTIAL)
+		spt->fa_window = FAULT_AROUND_MAX;
+	else if (va == spt->fa_next && spt->fa_window > 0)
+		spt->fa_window = spt->fa_window * 2 < FAULT_AROUND_MAX
+			? spt->fa_window * 2 : FAULT_AROUND_MAX;
+	else
+		spt->fa_window = 1;
+
+	pages[0] = page;
+	for (cnt = 1; cnt < spt->fa_window && !palloc_below_wmark (WMARK_LOW);
+			cnt++) {
+		pages[cnt] = spt_find_page (spt, va + cnt * PGSIZE);
+		if (pages[cnt] == NULL || !is_file_backed (pages[cnt]))
+			break;
+	}
+
+	for (i = 0; i < cnt; ) {
+		size_t run = cache_run (pages + i, cnt - i);
+		size_t done;
+
+		if (run > 0)
+			done = vm_map_cache (pages + i, run);
+		else
+			done = vm_do_claim_page (pages[i]) ? 1 : 0;
+		i += done;
+		if (done == 0 || done < run)
+			break;
+	}
+	spt->fa_next = va + i * PGSIZE;
+	return i > 0;
+}
+
+/* Memory advice.
+ *
+ * madvise() records MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL in
+ * each page of its range, for fault-around and the clock to act on.
+ * MADV_WILLNEED brings the pages in at once, as long as there are
+ * free frames.  MADV_DONTNEED discards the contents of anonymous
+ * pages, which read as zeros afterward, and makes the other pages
+ * the first to be evicted unless they are touched again.  Anonymous
+ * pages that were loaded from a file, like those of an initialized
+ * data segment, count as other pages: zeros would not bring their
+ * contents back. */
+
+/* Counts PAGE in *CNT_. */
+static bool
+count_page (struct page *page UNUSED, void *cnt_) {
+	size_t *cnt = cnt_;
+
+	(*cnt)++;
+	return true;
+}
+
+/* Turns PAGE, an anonymous page, back into one that was never
+ * touched, freeing its frame or swap slot. */
+static void
+discard_page (struct page *page) {
+	struct page old = *page;
+
+	destroy (page);
+	uninit_new (page, old.va, NULL, VM_ANON, NULL, anon_initializer);
+	page->writable = old.writable;
+	page->owner = old.owner;
+	page->advice = old.advice;
 }
 
-/* Handle the fault on write_protected page */
+/* Acts on the advice in *ADVICE_ for PAGE.  Stops a MADV_WILLNEED
+ * walk once free memory runs low. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+advise_page (struct page *page, void *advice_) {
+	int advice = *(int *) advice_;
+
+	switch (advice) {
+		case MADV_WILLNEED:
+			lock_acquire (&frame_lock);
+			wait_for_eviction (page);
+			lock_release (&frame_lock);
+			if (page->frame != NULL || is_untouched (page))
+				return true;
+			if (palloc_below_wmark (WMARK_LOW))
+				return false;
+			vm_do_claim_page (page);
+			return true;
+		case MADV_DONTNEED:
+			if (VM_TYPE (page->operations->type) == VM_ANON
+					&& !page->anon.file_data) {
+				discard_page (page);
+				return true;
+			}
+			if (page->frame != NULL)
+				pml4_set_accessed (page->owner->pml4, page->va, false);
+			page->advice = advice;
+			return true;
+		default:
+			page->advice = advice;
+			return true;
+	}
+}
+
+/* Applies ADVICE to the pages from ADDR, which must be page-aligned,
+ * for LENGTH bytes.  Returns 0 on success, or -1 if the advice is not
+ * known or part of the range is not mapped. */
+int
+do_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = (uint8_t *) addr + length;
+	size_t cnt = 0;
+
+	if (pg_ofs (addr) != 0 || end < (uint8_t *) addr
+			|| (length > 0 && !is_user_vaddr (end - 1))
+			|| advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return -1;
+	end = pg_round_up (end);
+	spt_for_each (spt, addr, end, count_page, &cnt);
+	if (cnt != (size_t) (end - (uint8_t *) addr) >> PGBITS)
+		return -1;
+	if (advice == MADV_DONTNEED) {
+		struct vm_gather g;
+
+		vm_gather_begin (spt, &g);
+		spt_for_each (spt, addr, end, advise_page, &advice);
+		vm_gather_end (spt);
+	} else
+		spt_for_each (spt, addr, end, advise_page, &advice);
+	return 0;
 }
 
-/* Return true on success */
+/* Return true on success.  Sets *TYPE to the FAULT_* type of the
+ * fault, as far as it got. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present, int *type) {
+	struct thread *curr = thread_current ();
+	struct page *page;
 
-	return vm_do_claim_page (page);
+	*type = FAULT_FATAL;
+	if (addr == NULL || !is_user_vaddr (addr))
+		return false;
+
+	page = spt_find_page (&curr->spt, addr);
+	if (!not_present) {
+		*type = FAULT_COW;
+		return write && page != NULL && page->writable
+			&& vm_handle_wp (page);
+	}
+	if (page == NULL) {
+		/* A fault in the kernel during a system call is checked
+		 * against the user's stack pointer at entry. */
+		void *rsp = user ? (void *) f->rsp : curr->user_rsp;
+		struct vm_area *vma = vma_find (&curr->spt, addr,
+				(uint8_t *) addr + 1);
+
+		if (vma == NULL || vma->kind != VMA_STACK
+				|| !is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (&curr->spt, addr);
+		if (page == NULL)
+			return false;
+		*type = FAULT_STACK;
+	} else if (is_untouched (page))
+		*type = FAULT_ZERO;
+	else if (VM_TYPE (page->operations->type) == VM_ANON)
+		*type = FAULT_SWAP;
+	else
+		*type = FAULT_LAZY;
+	if (write && !page->writable)
+		return false;
+
+	/* The page may be on its way out; if eviction failed instead, it
+	 * is mapped again and there is nothing to do. */
+	lock_acquire (&frame_lock);
+	wait_for_eviction (page);
+	lock_release (&frame_lock);
+	if (page->frame != NULL)
+		return true;
+
+	if (!write && is_untouched (page))
+		return map_zero_page (page);
+	if (!is_file_backed (page))
+		return vm_do_claim_page (page);
+	return fault_around (&curr->spt, page);
 }
 
 /* Free the page.
@@ -150,41 +1053,918 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
+/* Returns the cache page that PAGE, a page of a mapped file or of
+ * text, maps, binding PAGE to it first if PAGE is uninit, or NULL if
+ * PAGE is of another type or cannot be bound. */
+static struct cache_page *
+page_cache_page (struct page *page) {
+	/* Binding an uninit mapped page reads nothing into KVA. */
+	if (page_get_type (page) != VM_FILE
+			|| (VM_TYPE (page->operations->type) == VM_UNINIT
+				&& !swap_in (page, NULL)))
+		return NULL;
+	return page->file.cache;
+}
+
+/* Maps the frame of PAGE's cache page at PAGE, a page of a mapped
+ * file or of text, reading the cache page into a new frame if it is
+ * not in memory.  If PIN, leaves the frame pinned. */
+static bool
+claim_cache (struct page *page, bool pin) {
+	struct cache_page *cp = page_cache_page (page);
+	struct frame *frame;
+
+	if (cp == NULL)
+		return false;
+	frame = vm_cache_pin (cp, true);
+	if (frame == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	rmap_add (frame, page);
+	lock_release (&frame_lock);
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_unpin_frame (frame);
+		vm_free_frame (page);
+		return false;
+	}
+	if (!pin)
+		vm_unpin_frame (frame);
+	return true;
+}
+
+/* Gives PAGE a frame, maps it, and brings in its contents.  If PIN,
+ * leaves the frame pinned. */
+static bool
+claim_page (struct page *page, bool pin) {
+	struct frame *frame;
+	bool success;
+
+	if (page_get_type (page) == VM_FILE)
+		return claim_cache (page, pin);
+
+	frame = frame_for (page);
+	if (frame == NULL)
+		return false;
+
+	/* Set links */
+	lock_acquire (&frame_lock);
+	rmap_add (frame, page);
+	lock_release (&frame_lock);
+
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_free_frame (page);
+		return false;
+	}
+	success = swap_in (page, frame->kva);
+
+	if (!pin) {
+		lock_acquire (&frame_lock);
+		frame->pin_cnt--;
+		lock_release (&frame_lock);
+	}
+	return success;
+}
+
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	return claim_page (page, false);
+}
 
-	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+/* Unmaps PAGE and frees its frame, if it has one and no other page
+ * shares it.  A frame of the page cache is kept cached instead.  The destroy
+ * handlers of the page types call this.  Inside vm_gather_begin()
+ * and vm_gather_end() on the current process's table, the TLB
+ * invalidation and the freeing wait for vm_gather_end(). */
+void
+vm_free_frame (struct page *page) {
+	struct vm_gather *g = NULL;
+	struct frame *frame;
+
+	bool last = false;
+
+	if (page->owner == thread_current ())
+		g = page->owner->spt.gather;
+
+	lock_acquire (&frame_lock);
+	wait_for_eviction (page);
+	frame = page->frame;
+	if (frame != NULL) {
+		last = rmap_del (frame, page) && frame->cache == NULL;
+		if (last)
+			frame_unlink (frame);
+	}
+	lock_release (&frame_lock);
+	if (frame == NULL)
+		return;
+
+	if (page->owner->pml4 != NULL) {
+		if (g != NULL)
+			tlb_gather_clear_page (&g->tlb, page->va);
+		else
+			pml4_clear_page (page->owner->pml4, page->va);
+	}
+	if (last && g != NULL)
+		list_push_back (&g->frames, &frame->elem);
+	else if (last) {
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Batched unmapping.
+ *
+ * Operations that unmap many pages of the current process at once,
+ * munmap(), MADV_DONTNEED and exit, put them between
+ * vm_gather_begin() and vm_gather_end().  In between, vm_free_frame()
+ * clears PTEs without touching the TLB, and holds on to the frames it
+ * would free, since stale TLB entries may still point to them.
+ * vm_gather_end() then does all the invalidations, flushing the whole
+ * address space past TLB_GATHER_MAX pages, and frees the frames. */
+
+/* Starts gathering the unmappings in SPT, the current process's
+ * table, into G. */
+void
+vm_gather_begin (struct supplemental_page_table *spt, struct vm_gather *g) {
+	ASSERT (spt == &thread_current ()->spt);
+	ASSERT (spt->gather == NULL);
+
+	tlb_gather_init (&g->tlb, thread_current ()->pml4);
+	list_init (&g->frames);
+	spt->gather = g;
+}
+
+/* Flushes the TLB for the unmappings gathered in SPT and frees the
+ * frames they released. */
+void
+vm_gather_end (struct supplemental_page_table *spt) {
+	struct vm_gather *g = spt->gather;
+
+	ASSERT (g != NULL);
+
+	spt->gather = NULL;
+	tlb_gather_finish (&g->tlb);
+	while (!list_empty (&g->frames)) {
+		struct frame *frame = list_entry (list_pop_front (&g->frames),
+				struct frame, elem);
+
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Makes KVA, a page from the user pool that already holds PAGE's
+ * contents, the frame of PAGE, and maps it.  Swap-in uses this for
+ * the pages it reads ahead.  On failure, frees KVA and returns
+ * false. */
+bool
+vm_install_frame (struct page *page, void *kva) {
+	struct frame *frame = malloc (sizeof *frame);
+
+	if (frame == NULL || !pml4_set_page (page->owner->pml4, page->va, kva,
+				page->writable)) {
+		free (frame);
+		palloc_free_page (kva);
+		return false;
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	frame->cache = NULL;
+	frame->ref_cnt = 0;
+	frame->pin_cnt = 0;
+	frame->evicting = false;
+	frame->checksum = 0;
+	frame->ksm_listed = false;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_list, &frame->elem);
+	frame_cnt++;
+	rmap_add (frame, page);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Brings PAGE in, if it is not already, and pins its frame. */
+static bool
+pin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	wait_for_eviction (page);
+	if (page->frame != NULL) {
+		page->frame->pin_cnt++;
+		lock_release (&frame_lock);
+		return true;
+	}
+	lock_release (&frame_lock);
+	return claim_page (page, true);
+}
+
+/* Pins PAGE's frame and returns it, if PAGE is resident, or returns
+ * NULL if it is not.  Unlike pin_page(), never brings PAGE in. */
+struct frame *
+vm_pin_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	wait_for_eviction (page);
+	frame = page->frame;
+	if (frame != NULL)
+		frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Undoes vm_pin_frame(). */
+void
+vm_unpin_frame (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Page cache frames.
+ *
+ * A cache page's FRAME, LOADING and ACCESSED are protected by
+ * frame_lock, and a frame holds a reference to its cache page.
+ * LOADING marks a cache page being read into a new frame, and
+ * whoever wants it meanwhile waits on EVICT_DONE.  Runs of
+ * missing pages are read with one disk request each. */
+
+/* Most cache pages cache_fill() reads with one disk request. */
+#define CACHE_FILL_MAX 16
+
+/* Reads those of the CNT cache pages at CPS[], consecutive pages of
+ * one file, that are neither in memory nor being read, into new
+ * frames.  If FIRST is nonnull and CPS[0] is read here, leaves its
+ * frame pinned and stores it in *FIRST.  Returns false if memory runs
+ * out or a read fails. */
+static bool
+cache_fill (struct cache_page *cps[], size_t cnt, struct frame **first) {
+	size_t i = 0;
+
+	while (i < cnt) {
+		struct frame *frames[CACHE_FILL_MAX];
+		void *kvas[CACHE_FILL_MAX];
+		size_t run = 0, got, j;
+		bool ok;
+
+		lock_acquire (&frame_lock);
+		while (i + run < cnt && run < CACHE_FILL_MAX
+				&& cps[i + run]->frame == NULL && !cps[i + run]->loading)
+			cps[i + run++]->loading = true;
+		lock_release (&frame_lock);
+		if (run == 0) {
+			i++;
+			continue;
+		}
+
+		for (got = 0; got < run; got++) {
+			frames[got] = vm_get_frame ();
+			if (frames[got] == NULL)
+				break;
+			kvas[got] = frames[got]->kva;
+		}
+		ok = got > 0 && page_cache_load (cps[i], kvas, got);
+
+		lock_acquire (&frame_lock);
+		for (j = 0; j < run; j++) {
+			struct cache_page *cp = cps[i + j];
+
+			cp->loading = false;
+			if (j >= got)
+				continue;
+			if (!ok) {
+				frame_unlink (frames[j]);
+				continue;
+			}
+			frames[j]->cache = cp;
+			cp->frame = frames[j];
+			cp->accessed = true;
+			page_cache_hold (cp);
+			if (first != NULL && i + j == 0)
+				*first = frames[j];
+			else
+				frames[j]->pin_cnt--;
+		}
+		cond_broadcast (&evict_done, &frame_lock);
+		lock_release (&frame_lock);
+
+		if (!ok) {
+			for (j = 0; j < got; j++) {
+				palloc_free_page (frames[j]->kva);
+				free (frames[j]);
+			}
+			return false;
+		}
+		if (got < run)
+			return false;
+		i += run;
+	}
+	return true;
+}
+
+/* Reads those of the CNT cache pages at CPS[], consecutive pages of
+ * one file, that are not in memory, as far as memory allows. */
+void
+vm_cache_fill (struct cache_page *cps[], size_t cnt) {
+	cache_fill (cps, cnt, NULL);
+}
+
+/* Returns CP's frame, pinned.  If CP is not in memory, reads it into
+ * a new frame if LOAD, or returns NULL if not.  Returns NULL if CP
+ * cannot be read. */
+struct frame *
+vm_cache_pin (struct cache_page *cp, bool load) {
+	for (;;) {
+		struct frame *frame = NULL;
+
+		lock_acquire (&frame_lock);
+		while (cp->loading
+				|| (cp->frame != NULL && cp->frame->evicting))
+			cond_wait (&evict_done, &frame_lock);
+		frame = cp->frame;
+		if (frame != NULL) {
+			frame->pin_cnt++;
+			cp->accessed = true;
+		}
+		lock_release (&frame_lock);
+		if (frame != NULL || !load)
+			return frame;
+
+		/* Someone else may have started reading CP first. */
+		if (!cache_fill (&cp, 1, &frame))
+			return NULL;
+		if (frame != NULL)
+			return frame;
+	}
+}
+
+/* Returns how many of the CNT pages at PAGES[], from the first, make
+ * up a run that vm_map_cache() can bring in at once: equally
+ * writable pages of a mapped file or of text, bound to consecutive
+ * pages of one file.
+ * Binds the uninit pages it looks at. */
+static size_t
+cache_run (struct page *pages[], size_t cnt) {
+	struct cache_page *first = cnt > 0 ? page_cache_page (pages[0]) : NULL;
+	size_t run;
+
+	if (first == NULL)
+		return 0;
+	for (run = 1; run < cnt && run < CACHE_FILL_MAX; run++) {
+		struct cache_page *cp = page_cache_page (pages[run]);
+
+		if (cp == NULL || cp->inode != first->inode
+				|| cp->ofs != first->ofs + (off_t) (run * PGSIZE)
+				|| pages[run]->writable != pages[0]->writable)
+			break;
+	}
+	return run;
+}
+
+/* Brings in the CNT pages at PAGES[], at most CACHE_FILL_MAX
+ * consecutive pages of one process that make up a run as
+ * cache_run() describes, none of them resident.  The cache pages
+ * missing from memory are read first, with as few disk requests as
+ * possible, and then every page maps its cache page's frame, with one
+ * walk of the page table for all of them.  Stops at the first cache
+ * page that cannot be read.  Returns the number of pages brought
+ * in. */
+size_t
+vm_map_cache (struct page *pages[], size_t cnt) {
+	struct cache_page *cps[CACHE_FILL_MAX];
+	struct frame *frames[CACHE_FILL_MAX];
+	void *kvas[CACHE_FILL_MAX];
+	size_t got, i;
+
+	ASSERT (cnt <= CACHE_FILL_MAX);
+
+	for (i = 0; i < cnt; i++)
+		cps[i] = pages[i]->file.cache;
+	cache_fill (cps, cnt, NULL);
+
+	/* A page read just now may be evicted again before it is pinned,
+	 * which ends the run there. */
+	for (got = 0; got < cnt; got++) {
+		frames[got] = vm_cache_pin (cps[got], false);
+		if (frames[got] == NULL)
+			break;
+		kvas[got] = frames[got]->kva;
+	}
+	if (got == 0)
+		return 0;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < got; i++)
+		rmap_add (frames[i], pages[i]);
+	lock_release (&frame_lock);
+	if (!pml4_set_pages (pages[0]->owner->pml4, pages[0]->va, kvas, got,
+				pages[0]->writable)) {
+		for (i = 0; i < got; i++) {
+			vm_unpin_frame (frames[i]);
+			vm_free_frame (pages[i]);
+		}
+		return 0;
+	}
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < got; i++)
+		frames[i]->pin_cnt--;
+	lock_release (&frame_lock);
+	return got;
+}
+
+/* Frees CP's frame, if it has one, which no page may map.  Used when
+ * CP's inode is closed for the last time. */
+void
+vm_cache_drop (struct cache_page *cp) {
+	struct vm_gather *g = thread_current ()->spt.gather;
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (cp->loading || (cp->frame != NULL && cp->frame->evicting))
+		cond_wait (&evict_done, &frame_lock);
+	frame = cp->frame;
+	if (frame != NULL) {
+		ASSERT (frame->ref_cnt == 0 && frame->pin_cnt == 0);
+		frame_unlink (frame);
+		frame->cache = NULL;
+		cp->frame = NULL;
+		page_cache_put (cp);
+	}
+	lock_release (&frame_lock);
+
+	/* The last page to map the frame may have been unmapped by the
+	 * current process inside vm_gather_begin() and vm_gather_end(),
+	 * with the TLB not flushed yet. */
+	if (frame != NULL && g != NULL)
+		list_push_back (&g->frames, &frame->elem);
+	else if (frame != NULL) {
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+}
+
+/* Undoes pin_page (PAGE). */
+static void
+unpin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame != NULL && page->frame->pin_cnt > 0);
+	page->frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+/* Unpins the pages from VA up to END in the current process. */
+static void
+unpin_pages (uint8_t *va, const uint8_t *end) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 
-	return swap_in (page, frame->kva);
+	for (; va < end; va += PGSIZE)
+		unpin_page (spt_find_page (spt, va));
+}
+
+/* Brings in every page of the user buffer [ADDR, ADDR + SIZE) and pins
+ * it, so that kernel I/O to or from the buffer neither faults nor
+ * races with eviction.  WRITE means the kernel will write to the
+ * buffer.  Returns false, with nothing pinned, if part of the buffer
+ * is not valid user memory. */
+bool
+vm_pin_range (const void *addr, size_t size, bool write) {
+	struct thread *curr = thread_current ();
+	const uint8_t *end = (const uint8_t *) addr + size;
+	uint8_t *va;
+
+	if (size == 0)
+		return true;
+	if (end < (const uint8_t *) addr || !is_user_vaddr (end - 1))
+		return false;
+	for (va = pg_round_down (addr); va < end; va += PGSIZE) {
+		const void *first = va < (uint8_t *) addr ? addr : va;
+		struct page *page = spt_find_page (&curr->spt, va);
+
+		if (page == NULL && is_stack_access (first, curr->user_rsp)) {
+			vm_stack_growth (va);
+			page = spt_find_page (&curr->spt, va);
+		}
+		/* The kernel is about to write: break copy-on-write now
+		 * rather than fault on it, possibly holding locks. */
+		if (page == NULL || (write && !page->writable)
+				|| (write && is_cow (page) && !vm_handle_wp (page))
+				|| !pin_page (page))
+			goto fail;
+	}
+	return true;
+
+fail:
+	unpin_pages (pg_round_down (addr), va);
+	return false;
+}
+
+/* Undoes vm_pin_range (ADDR, SIZE). */
+void
+vm_unpin_range (const void *addr, size_t size) {
+	if (size > 0)
+		unpin_pages (pg_round_down (addr), (const uint8_t *) addr + size);
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->root = NULL;
+	spt->page_cnt = 0;
+	interval_init (&spt->vmas);
+	spt->fa_next = NULL;
+	spt->fa_window = 0;
+	spt->rss = 0;
+	memset (spt->fault_cnt, 0, sizeof spt->fault_cnt);
+	spt->gather = NULL;
+}
+
+/* Gives the current process, whose table is DST, a copy-on-write
+ * copy of SRC, which must be resident: both pages map SRC's frame
+ * read-only from now on. */
+static bool
+share_page (struct page *src, struct supplemental_page_table *dst) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct frame *frame = src->frame;
+	struct page *page = malloc (sizeof *page);
+
+	if (page == NULL)
+		return false;
+	*page = *src;
+	page->frame = NULL;
+	page->owner = thread_current ();
+	if (!spt_insert_page (dst, page)) {
+		free (page);
+		return false;
+	}
+	if (!pml4_set_page (pml4, page->va, frame->kva, false)) {
+		spt_remove_page (dst, page);
+		return false;
+	}
+
+	lock_acquire (&frame_lock);
+	rmap_add (frame, page);
+	lock_release (&frame_lock);
+
+	/* The parent waits for us, so it cannot be using this. */
+	if (src->writable)
+		pml4_set_page (src->owner->pml4, src->va, frame->kva, false);
+	return true;
+}
+
+/* Gives the current process, whose table is DST_, a copy of SRC.
+ * Anonymous pages are shared copy-on-write, and text is shared as
+ * it is between processes.  Mapped file pages are
+ * not inherited as mappings: the child gets private anonymous
+ * copies of them. */
+static bool
+copy_page (struct page *src, void *dst_) {
+	struct supplemental_page_table *dst = dst_;
+	struct page *page;
+	bool success;
+
+	if (page_is_text (src))
+		return text_copy_page (src);
+
+	/* Nothing to copy yet. */
+	if (VM_TYPE (src->operations->type) == VM_UNINIT
+			&& src->uninit.init == NULL)
+		return vm_alloc_page (src->uninit.type, src->va, src->writable);
+
+	/* Hold SRC in memory while copying.  The initializer's AUX of an
+	 * uninit page belongs to SRC, so such a page is loaded in SRC and
+	 * then copied. */
+	if (!pin_page (src))
+		return false;
+	if (VM_TYPE (src->operations->type) == VM_ANON)
+		success = share_page (src, dst);
+	else {
+		success = vm_alloc_page (VM_ANON, src->va, src->writable)
+			&& (page = spt_find_page (dst, src->va)) != NULL
+			&& pin_page (page);
+		if (success) {
+			memcpy (page->frame->kva, src->frame->kva, PGSIZE);
+			page->anon.file_data = true;
+			unpin_page (page);
+		}
+	}
+	unpin_page (src);
+	return success;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct vm_area *vma;
+
+	ASSERT (dst == &thread_current ()->spt);
+
+	/* The child's copies of mapped regions are private memory. */
+	for (vma = vma_find (src, NULL, (void *) KERN_BASE); vma != NULL;
+			vma = vma_next (vma, NULL, (void *) KERN_BASE))
+		if (!vma_add (dst, vma_start (vma), vma_end (vma),
+					vma->kind == VMA_MMAP ? VMA_PRIVATE : vma->kind))
+			return false;
+	return spt_for_each (src, NULL, (void *) KERN_BASE, copy_page, dst);
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct vm_gather g;
+	struct vm_area *vma;
+
+	do_munmap_all (spt);
+	while ((vma = vma_find (spt, NULL, (void *) KERN_BASE)) != NULL) {
+		vma_remove (spt, vma);
+		free (vma);
+	}
+	vm_gather_begin (spt, &g);
+	if (spt->root != NULL)
+		spt_destroy (spt->root, 0);
+	vm_gather_end (spt);
+	supplemental_page_table_init (spt);
+}
+
+/* Same-page merging.
+ *
+ * KSMD, a kernel thread of the lowest priority, wakes up every
+ * KSM_SLEEP ticks and scans the next KSM_BATCH frames of the frame
+ * table for anonymous frames that have the same contents as another
+ * frame.  Such a frame is merged into the other, which its page then
+ * shares copy-on-write, just as after fork.
+ *
+ * A frame is only merged once its checksum has come out the same on
+ * two scans in a row, so that pages being written are left alone.
+ * KSM_TABLE holds one frame for each checksum seen.  A frame whose
+ * checksum matches one there, or that of ZERO_FRAME, is compared with
+ * that frame byte for byte, with both write-protected so that neither
+ * can change meanwhile, and merged if they are equal.  If they are
+ * not, the pages stay write-protected, and the first write to either
+ * gets its frame back through vm_handle_wp() without a copy.
+ *
+ * While it works on a frame, ksmd marks it EVICTING, so that faults
+ * on the frame's pages, and attempts to free them, wait until it is
+ * done. */
+#define KSM_BATCH 64
+#define KSM_SLEEP 20
+
+static struct hash ksm_table;           /* Protected by frame_lock. */
+static unsigned zero_checksum;
+
+static void ksmd (void *aux);
+
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->checksum;
+}
+
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->checksum
+		< hash_entry (b, struct frame, ksm_elem)->checksum;
+}
+
+/* Returns the checksum of the page at KVA. */
+static unsigned
+page_checksum (const void *kva) {
+	return hash_bytes (kva, PGSIZE);
+}
+
+/* Sets up same-page merging and starts ksmd. */
+static void
+ksm_init (void) {
+	hash_init (&ksm_table, ksm_hash, ksm_less, NULL);
+	zero_checksum = page_checksum (zero_frame.kva);
+	thread_create ("ksmd", PRI_MIN, ksmd, NULL);
+}
+
+/* Removes FRAME from the merge table, if it is there.  Called with
+ * frame_lock held. */
+static void
+ksm_forget (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* Returns true if FRAME holds anonymous memory only, mapped by one
+ * or more pages, and is free to be worked on.  Called with
+ * frame_lock held. */
+static bool
+ksm_is_anon (struct frame *frame) {
+	if (frame->pin_cnt > 0 || frame->evicting || frame->cache != NULL
+			|| frame->ref_cnt == 0)
+		return false;
+	/* Only anonymous frames are ever shared by more than one page,
+	 * the page cache aside. */
+	if (frame->ref_cnt > 1)
+		return true;
+	return frame->page != NULL
+		&& VM_TYPE (frame->page->operations->type) == VM_ANON
+		&& frame->page->owner->pml4 != NULL;
+}
+
+/* Returns the next frame to try to merge, marked EVICTING, or NULL if
+ * a sweep of the whole table finds none.  Only a frame of a single
+ * page is merged into another. */
+static struct frame *
+ksm_next (void) {
+	struct frame *frame = NULL;
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < frame_cnt; i++) {
+		struct list_elem *e = ksm_cursor;
+
+		if (e == NULL || e == list_end (&frame_list))
+			e = list_begin (&frame_list);
+		ksm_cursor = list_next (e);
+		frame = list_entry (e, struct frame, elem);
+		if (frame->ref_cnt == 1 && frame->page != NULL && ksm_is_anon (frame))
+			break;
+		frame = NULL;
+	}
+	if (frame != NULL)
+		frame->evicting = true;
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Maps PAGE, with its frame, read-only. */
+static void
+write_protect (struct page *page) {
+	uint64_t *pml4 = page->owner->pml4;
+	bool dirty = pml4_is_dirty (pml4, page->va);
+
+	pml4_set_page (pml4, page->va, page->frame->kva, false);
+	pml4_set_dirty (pml4, page->va, dirty);
+}
+
+/* Tries to merge FRAME, which ksm_next() returned, into a frame with
+ * the same contents.  Returns true if it was merged and freed. */
+static bool
+ksm_merge (struct frame *frame) {
+	unsigned checksum = page_checksum (frame->kva);
+	struct page *page = frame->page;
+	struct frame *other = NULL;
+	bool merged;
+
+	lock_acquire (&frame_lock);
+	ksm_forget (frame);
+	if (checksum != frame->checksum)
+		frame->checksum = checksum;
+	else if (checksum == zero_checksum)
+		other = &zero_frame;
+	else {
+		struct hash_elem *e = hash_insert (&ksm_table, &frame->ksm_elem);
+
+		frame->ksm_listed = true;
+		if (e != NULL) {
+			/* A frame last seen with the same contents. */
+			other = hash_entry (e, struct frame, ksm_elem);
+			if (ksm_is_anon (other)) {
+				hash_delete (&ksm_table, &frame->ksm_elem);
+				frame->ksm_listed = false;
+				other->evicting = true;
+			} else {
+				hash_replace (&ksm_table, &frame->ksm_elem);
+				other->ksm_listed = false;
+				other = NULL;
+			}
+		}
+	}
+	if (other == NULL) {
+		frame->evicting = false;
+		cond_broadcast (&evict_done, &frame_lock);
+	}
+	lock_release (&frame_lock);
+	if (other == NULL)
+		return false;
+
+	/* A frame of more than one page is read-only everywhere
+	 * already, and so is the zero frame, which has no page. */
+	if (other != &zero_frame && other->ref_cnt == 1
+			&& other->page->writable)
+		write_protect (other->page);
+	if (page->writable)
+		write_protect (page);
+	merged = !memcmp (frame->kva, other->kva, PGSIZE);
+	if (merged)
+		pml4_set_page (page->owner->pml4, page->va, other->kva, false);
+
+	lock_acquire (&frame_lock);
+	frame->evicting = false;
+	if (other != &zero_frame) {
+		other->evicting = false;
+		if (!merged) {
+			/* OTHER has changed since it was listed. */
+			ksm_forget (other);
+			if (hash_insert (&ksm_table, &frame->ksm_elem) == NULL)
+				frame->ksm_listed = true;
+		}
+	}
+	if (merged) {
+		rmap_del (frame, page);
+		rmap_add (other, page);
+		frame_unlink (frame);
+	}
+	cond_broadcast (&evict_done, &frame_lock);
+	lock_release (&frame_lock);
+
+	if (merged) {
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+	return merged;
+}
+
+/* Kernel thread that merges identical anonymous frames. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		struct frame *frame;
+		int i;
+
+		timer_sleep (KSM_SLEEP);
+		for (i = 0; i < KSM_BATCH && (frame = ksm_next ()) != NULL; i++)
+			ksm_merge (frame);
+	}
+}
+
+/* Reclaim.
+ *
+ * KSWAPD keeps free memory between the watermarks of
+ * palloc_below_wmark(): vm_get_frame() wakes it when free memory
+ * falls below the low watermark, and it evicts in the background
+ * until free memory is back at the high one, so that most faults
+ * find a free frame and do not have to evict one themselves.  A
+ * fault evicts on its own only if kswapd falls behind.
+ *
+ * A process that has RSS_LIMIT pages resident does not get more
+ * frames: each further page it brings in takes the frame of one of
+ * its own pages, chosen by the clock among that process's frames, so
+ * that a process that thrashes does so against its own working set
+ * and not everyone else's. */
+static struct semaphore kswapd_wakeup;
+static bool kswapd_awake;               /* Protected by frame_lock. */
+
+static void kswapd (void *aux);
+
+/* Starts kswapd. */
+static void
+kswapd_init (void) {
+	sema_init (&kswapd_wakeup, 0);
+	thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL);
+}
+
+/* Wakes kswapd, unless it is already at work. */
+static void
+kswapd_wake (void) {
+	bool wake;
+
+	lock_acquire (&frame_lock);
+	wake = !kswapd_awake;
+	kswapd_awake = true;
+	lock_release (&frame_lock);
+	if (wake)
+		sema_up (&kswapd_wakeup);
+}
+
+/* Kernel thread that evicts frames until free memory is back at
+ * the high watermark. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_wakeup);
+		while (palloc_below_wmark (WMARK_HIGH)) {
+			struct frame *frame = vm_evict_frame (NULL);
+
+			if (frame == NULL)
+				break;
+			lock_acquire (&frame_lock);
+			frame_unlink (frame);
+			lock_release (&frame_lock);
+			palloc_free_page (frame->kva);
+			free (frame);
+		}
+		lock_acquire (&frame_lock);
+		kswapd_awake = false;
+		lock_release (&frame_lock);
+	}
 }
@@ -0,0 +1,372 @@
+/* zswap.c: Compressed cache of swapped-out anonymous pages. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap pool.
+ *
+ * Before an anonymous page goes to the swap disk, anon_swap_out()
+ * offers it to zswap_store(), which compresses it with a small LZ77
+ * compressor and, if the result is small enough, keeps it in a pool
+ * of kernel pages instead.  Swap-in from the pool is a decompression
+ * rather than a disk transfer.  Only pages that do not compress well,
+ * or that find the pool full, are written to disk.
+ *
+ * The pool grows one page at a time, up to POOL_PAGES, and gives a
+ * page back as soon as nothing is stored in it.  A pool page is
+ * divided into CHUNK_SIZE-byte chunks, with a bit in CHUNK_MAP for
+ * each chunk in use, and a compressed page takes a run of chunks
+ * within one pool page.  Its handle encodes the pool page, the first
+ * chunk and the number of chunks. */
+#define POOL_PAGES 256                  /* Most pages in the pool. */
+#define CHUNK_SIZE 64                   /* Allocation unit. */
+#define CHUNK_CNT (PGSIZE / CHUNK_SIZE) /* Chunks per pool page. */
+
+/* Largest compressed page worth keeping, header included.  A page
+ * that does not shrink at least this much goes to disk. */
+#define STORE_MAX (PGSIZE * 3 / 4)
+
+/* A stored page starts with a header giving the length of the
+ * compressed data that follows and the number of pages that refer to
+ * it, both 16 bits. */
+#define HEADER_SIZE 4
+
+static struct lock zswap_lock;          /* Protects everything below. */
+static uint8_t *pool[POOL_PAGES];       /* Pool pages, or nulls. */
+static uint64_t chunk_map[POOL_PAGES];  /* Chunks in use in each. */
+static uint8_t buffer[STORE_MAX];       /* Compression output. */
+
+/* Statistics. */
+static uint64_t store_cnt;              /* Pages stored. */
+static uint64_t reject_cnt;             /* Pages that compressed poorly. */
+static uint64_t full_cnt;               /* Pages turned away, pool full. */
+static uint64_t load_cnt;               /* Pages loaded back. */
+static size_t stored_bytes;             /* Compressed bytes in the pool. */
+
+static size_t lz_compress (const uint8_t *src, uint8_t *dst,
+		size_t dst_size);
+static bool lz_decompress (const uint8_t *src, size_t src_size,
+		uint8_t *dst);
+
+/* Initializes the compressed pool. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+}
+
+/* Makes a handle for CNT chunks from CHUNK in pool page PAGE. */
+static size_t
+make_handle (size_t page, size_t chunk, size_t cnt) {
+	return page << 16 | chunk << 8 | cnt;
+}
+
+/* Returns a mask of the CNT chunks from CHUNK. */
+static uint64_t
+chunk_mask (size_t chunk, size_t cnt) {
+	uint64_t bits = cnt < 64 ? ((uint64_t) 1 << cnt) - 1 : UINT64_MAX;
+
+	return bits << chunk;
+}
+
+/* Finds CNT free chunks in a row and marks them used, adding a page
+ * to the pool if none has room.  Returns their handle, or ZSWAP_NONE
+ * if the pool is full.  Called with zswap_lock held. */
+static size_t
+chunks_alloc (size_t cnt) {
+	size_t empty = POOL_PAGES;
+	size_t page, chunk;
+
+	for (page = 0; page < POOL_PAGES; page++) {
+		if (pool[page] == NULL) {
+			if (empty == POOL_PAGES)
+				empty = page;
+			continue;
+		}
+		for (chunk = 0; chunk + cnt <= CHUNK_CNT; chunk++)
+			if ((chunk_map[page] & chunk_mask (chunk, cnt)) == 0) {
+				chunk_map[page] |= chunk_mask (chunk, cnt);
+				return make_handle (page, chunk, cnt);
+			}
+	}
+
+	if (empty == POOL_PAGES
+			|| (pool[empty] = palloc_get_page (0)) == NULL)
+		return ZSWAP_NONE;
+	chunk_map[empty] = chunk_mask (0, cnt);
+	return make_handle (empty, 0, cnt);
+}
+
+/* Returns the data of the page stored under HANDLE. */
+static uint8_t *
+handle_data (size_t handle) {
+	return pool[handle >> 16] + (handle >> 8 & 0xff) * CHUNK_SIZE;
+}
+
+/* Compresses the page at KVA into the pool.  Returns its handle, or
+ * ZSWAP_NONE if it must go to disk instead. */
+size_t
+zswap_store (const void *kva) {
+	size_t size, handle;
+
+	lock_acquire (&zswap_lock);
+	size = lz_compress (kva, buffer + HEADER_SIZE, STORE_MAX - HEADER_SIZE);
+	if (size == 0) {
+		reject_cnt++;
+		handle = ZSWAP_NONE;
+	} else {
+		handle = chunks_alloc (DIV_ROUND_UP (HEADER_SIZE + size, CHUNK_SIZE));
+		if (handle == ZSWAP_NONE)
+			full_cnt++;
+		else {
+			buffer[0] = size & 0xff;
+			buffer[1] = size >> 8;
+			buffer[2] = 1;
+			buffer[3] = 0;
+			memcpy (handle_data (handle), buffer, HEADER_SIZE + size);
+			store_cnt++;
+			stored_bytes += HEADER_SIZE + size;
+		}
+	}
+	lock_release (&zswap_lock);
+	return handle;
+}
+
+/* Decompresses the page stored under HANDLE into KVA.  The page
+ * stays stored until zswap_free (HANDLE). */
+void
+zswap_load (size_t handle, void *kva) {
+	const uint8_t *data;
+	size_t size;
+
+	lock_acquire (&zswap_lock);
+	data = handle_data (handle);
+	size = data[0] | (size_t) data[1] << 8;
+	if (!lz_decompress (data + HEADER_SIZE, size, kva))
+		PANIC ("corrupt compressed page %#zx", handle);
+	load_cnt++;
+	lock_release (&zswap_lock);
+}
+
+/* Adds a reference to the page stored under HANDLE, for another
+ * page with the same contents. */
+void
+zswap_dup (size_t handle) {
+	uint8_t *data;
+	unsigned refs;
+
+	lock_acquire (&zswap_lock);
+	data = handle_data (handle);
+	refs = (data[2] | data[3] << 8) + 1;
+	ASSERT (refs <= UINT16_MAX);
+	data[2] = refs & 0xff;
+	data[3] = refs >> 8;
+	lock_release (&zswap_lock);
+}
+
+/* Drops a reference to the page stored under HANDLE, freeing it
+ * with the last one. */
+void
+zswap_free (size_t handle) {
+	size_t page = handle >> 16;
+	uint8_t *data;
+	unsigned refs;
+
+	lock_acquire (&zswap_lock);
+	data = handle_data (handle);
+	refs = (data[2] | data[3] << 8) - 1;
+	if (refs > 0) {
+		data[2] = refs & 0xff;
+		data[3] = refs >> 8;
+		lock_release (&zswap_lock);
+		return;
+	}
+	stored_bytes -= HEADER_SIZE + (data[0] | (size_t) data[1] << 8);
+	chunk_map[page] &= ~chunk_mask (handle >> 8 & 0xff, handle & 0xff);
+	if (chunk_map[page] == 0) {
+		palloc_free_page (pool[page]);
+		pool[page] = NULL;
+	}
+	lock_release (&zswap_lock);
+}
+
+/* Prints compressed pool statistics. */
+void
+zswap_print_stats (void) {
+	printf ("Zswap: %"PRIu64" stores, %"PRIu64" loads, %"PRIu64" poorly "
+			"compressed, %"PRIu64" pool full, %zu bytes stored\n",
+			store_cnt, load_cnt, reject_cnt, full_cnt, stored_bytes);
+}
+
+/* LZ77 compression.
+ *
+ * The compressed form is a series of sequences, each a token byte,
+ * a run of literal bytes and a match: a two-byte little-endian
+ * offset back into the output and a length.  The token's high four
+ * bits give the literal count, and its low four bits the match
+ * length less MIN_MATCH.  A field of 15 is continued by bytes that
+ * are added to it, up to and including the first one below 255.  The
+ * last sequence has only literals, and ends the page.
+ *
+ * The compressor finds matches through a hash table of the last
+ * position at which each 4-byte sequence was seen, which is fast and
+ * finds the long runs that make up most compressible pages. */
+#define MIN_MATCH 4
+#define HASH_BITS 12
+
+static uint16_t hash_table[1 << HASH_BITS]; /* Protected by zswap_lock. */
+
+/* Returns the 4 bytes at P. */
+static uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Returns the hash table index for V. */
+static size_t
+hash_seq (uint32_t v) {
+	return (uint32_t) (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Writes N, the part of a length beyond its token field, at *OP. */
+static void
+put_length (uint8_t **op, size_t n) {
+	for (; n >= 255; n -= 255)
+		*(*op)++ = 255;
+	*(*op)++ = n;
+}
+
+/* Appends a sequence of LIT_CNT literals from LIT followed by a
+ * match of MATCH_LEN bytes at OFFSET, or no match if MATCH_LEN is
+ * zero, at *OP.  Returns false, writing nothing, if that would go
+ * past OEND. */
+static bool
+put_sequence (uint8_t **op, const uint8_t *oend, const uint8_t *lit,
+		size_t lit_cnt, size_t offset, size_t match_len) {
+	size_t need = 1 + lit_cnt + (lit_cnt >= 15 ? lit_cnt / 255 + 1 : 0);
+	size_t lit_field = lit_cnt < 15 ? lit_cnt : 15;
+	size_t match_field = 0;
+
+	if (match_len > 0) {
+		size_t extra = match_len - MIN_MATCH;
+
+		match_field = extra < 15 ? extra : 15;
+		need += 2 + (extra >= 15 ? extra / 255 + 1 : 0);
+	}
+	if ((size_t) (oend - *op) < need)
+		return false;
+
+	*(*op)++ = lit_field << 4 | match_field;
+	if (lit_field == 15)
+		put_length (op, lit_cnt - 15);
+	memcpy (*op, lit, lit_cnt);
+	*op += lit_cnt;
+	if (match_len > 0) {
+		*(*op)++ = offset & 0xff;
+		*(*op)++ = offset >> 8;
+		if (match_field == 15)
+			put_length (op, match_len - MIN_MATCH - 15);
+	}
+	return true;
+}
+
+/* Compresses the page at SRC into DST, which has room for DST_SIZE
+ * bytes.  Returns the compressed size, or 0 if it does not fit. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t dst_size) {
+	const uint8_t *end = src + PGSIZE;
+	const uint8_t *ip = src, *anchor = src;
+	uint8_t *op = dst;
+
+	memset (hash_table, 0, sizeof hash_table);
+	while (ip + MIN_MATCH <= end) {
+		uint32_t seq = read32 (ip);
+		size_t h = hash_seq (seq);
+		const uint8_t *ref = src + hash_table[h];
+
+		hash_table[h] = ip - src;
+		if (ref < ip && read32 (ref) == seq) {
+			size_t len = MIN_MATCH;
+
+			while (ip + len < end && ref[len] == ip[len])
+				len++;
+			if (!put_sequence (&op, dst + dst_size, anchor, ip - anchor,
+						ip - ref, len))
+				return 0;
+			ip += len;
+			anchor = ip;
+		} else
+			ip++;
+	}
+	if (!put_sequence (&op, dst + dst_size, anchor, end - anchor, 0, 0))
+		return 0;
+	return op - dst;
+}
+
+/* Reads the continuation of a length field from *IP, which must not
+ * pass IEND, and adds it to *N.  Returns false on a truncated
+ * field. */
+static bool
+get_length (const uint8_t **ip, const uint8_t *iend, size_t *n) {
+	uint8_t b;
+
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*n += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC into the page at DST.
+ * Returns false if they are not a valid compressed page. */
+static bool
+lz_decompress (const uint8_t *src, size_t src_size, uint8_t *dst) {
+	const uint8_t *ip = src, *iend = src + src_size;
+	uint8_t *op = dst, *oend = dst + PGSIZE;
+
+	for (;;) {
+		size_t len, offset, i;
+		uint8_t token;
+
+		if (ip >= iend)
+			return false;
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15 && !get_length (&ip, iend, &len))
+			return false;
+		if (len > (size_t) (iend - ip) || len > (size_t) (oend - op))
+			return false;
+		memcpy (op, ip, len);
+		ip += len;
+		op += len;
+		if (op == oend)
+			return ip == iend;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | (size_t) ip[1] << 8;
+		ip += 2;
+		len = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15 && !get_length (&ip, iend, &len))
+			return false;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| len > (size_t) (oend - op))
+			return false;
+		/* The match may overlap what it produces. */
+		for (i = 0; i < len; i++)
+			op[i] = op[i - offset];
+		op += len;
+	}
+}